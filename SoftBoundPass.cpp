@@ -1,18 +1,143 @@
 // SoftBoundPass.cpp
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include <map>
 
 using namespace llvm;
 
+// bound_check() 호출 대신 IR에 직접 비교 코드를 삽입하는 모드
+static cl::opt<bool> ClInlineChecks(
+    "softbound-inline-checks",
+    cl::desc("Emit bounds checks inline with a cold out-of-line report path"),
+    cl::init(false));
+
+static cl::opt<bool> ClInlineMetadataLoad(
+    "softbound-inline-metadata-load",
+    cl::desc("Inline the metadata trie walk for pointer loads instead of calling get_metadata()"),
+    cl::init(true));
+
+// softbound.c의 SOFTBOUND_SLOT_BYTES와 같아야 한다
+static cl::opt<unsigned> ClSlotBytes(
+    "softbound-slot-bytes",
+    cl::desc("Bytes of memory covered by one metadata trie slot (8 or 16)"),
+    cl::init(8));
+
+// softbound.c의 SOFTBOUND_TEMPORAL과 같아야 한다
+static cl::opt<bool> ClTemporal(
+    "softbound-temporal",
+    cl::desc("Also check a per-allocation key/lock to catch use-after-free and double free"),
+    cl::init(false));
+
+// softbound.c의 KEY_PERMANENT/LOCK_PERMANENT: 해제되지 않는 global/stack/출처 모를 포인터
+static const uint64_t PermanentKey = 1;
+static const uint64_t PermanentLock = 1;
+
+// softbound.c의 trie 주소 분할
+static const unsigned TrieAddressBits = 48;
+static const unsigned TrieSecondaryBits = 22;
+
+static cl::opt<bool> ClLowFat(
+    "softbound-lowfat",
+    cl::desc("Allocate malloc/calloc blocks in size-class regions and derive the bounds of "
+             "loaded pointers from the pointer value instead of the metadata trie"),
+    cl::init(false));
+
+// softbound.c의 LOWFAT_REGION_BITS/LOWFAT_MIN_SHIFT: 영역 번호 i의 블록 크기는 1 << (i + 3)
+static const unsigned LowFatRegionBits = 35;
+static const unsigned LowFatMinShift = 4;
+
+static cl::opt<bool> ClFoldStaticChecks(
+    "softbound-fold-static-checks",
+    cl::desc("Resolve checks on constant offsets into fixed-size allocas and globals at compile time"),
+    cl::init(true));
+
+static cl::opt<bool> ClElimRedundantChecks(
+    "softbound-elim-redundant",
+    cl::desc("Remove checks dominated by an equal-or-wider check on the same pointer"),
+    cl::init(true));
+
+static cl::opt<bool> ClHoistLoopChecks(
+    "softbound-hoist-loop-checks",
+    cl::desc("Replace per-iteration checks of affine accesses with one pre-header range check"),
+    cl::init(true));
+
+static cl::opt<bool> ClCloneInternalFunctions(
+    "softbound-clone-internal-functions",
+    cl::desc("Pass pointer metadata of internal, non-address-taken functions as extra arguments"),
+    cl::init(true));
+
+static cl::opt<bool> ClCheckStats(
+    "softbound-stats",
+    cl::desc("Print the number of emitted and removed bounds checks"),
+    cl::init(false));
+
+// 검사 위치별 실행 횟수를 세어 종료 시 profile 파일(SOFTBOUND_PROFILE, 기본 softbound.profile)로 남긴다
+static cl::opt<bool> ClSiteCounters(
+    "softbound-site-counters",
+    cl::desc("Count executions of each load/store check site and dump a profile at exit"),
+    cl::init(false));
+
+/*
+-softbound-site-counters로 얻은 profile을 읽어 검사 위치마다 배치를 정한다.
+  hot  (>= hot-count) : loop 밖으로 끌어올리고 합치며, 남는 검사는 inline
+  warm                : 접근마다 inline 검사
+  cold (<  cold-count): bound_check() 호출로 code 크기를 줄인다
+profile에 없는 위치는 -softbound-inline-checks/-softbound-hoist-loop-checks를 따른다.
+*/
+static cl::opt<std::string> ClProfile(
+    "softbound-profile",
+    cl::desc("Check profile written by a -softbound-site-counters build"),
+    cl::value_desc("path"), cl::init(""));
+
+static cl::opt<uint64_t> ClProfileHotCount(
+    "softbound-profile-hot-count",
+    cl::desc("Profile count at or above which a check site is hot"),
+    cl::init(10000));
+
+static cl::opt<uint64_t> ClProfileColdCount(
+    "softbound-profile-cold-count",
+    cl::desc("Profile count below which a check site is cold"),
+    cl::init(100));
+
+// 디버깅용 추적 출력: load마다 print_metadata 호출을 삽입한다(runtime은 SOFTBOUND_TRACE=1로 빌드)
+static cl::opt<bool> ClTrace(
+    "softbound-trace",
+    cl::desc("Insert print_metadata calls after loads and print instrumentation notes"),
+    cl::init(false));
+
+// clang -O2 -emit-llvm로 만든 softbound.bc를 계측 전에 모듈에 링크해 검사 함수를 inline 한다
+static cl::opt<std::string> ClRuntimeBitcode(
+    "softbound-runtime-bc",
+    cl::desc("Link this runtime bitcode into the module and inline its hot entry points"),
+    cl::value_desc("path"), cl::init(""));
+
+// 링크된 runtime 함수 표시: 계측/복제 대상에서 제외
+static const char *const RuntimeFnAttr = "softbound-runtime";
+
 // using softbound's shadow space method
 /* Book-keeping structures for identifying original instructions in
  * the program, pointers and their corresponding base and bound
@@ -20,16 +145,93 @@ using namespace llvm;
 
 namespace
 {
-  struct SoftBoundPass : public PassInfoMixin<SoftBoundPass>
+  struct SoftBoundPass
   {
     static char ID;
+    // Key/Lock은 -softbound-temporal일 때만 채운다
     struct Metadata
     {
       Value *Base;
       Value *Bound;
+      Value *Key = nullptr;
+      Value *Lock = nullptr;
+    };
+
+    // 포인터 PHI와 그에 대응하는 base/bound shadow PHI.
+    // back-edge로 들어오는 값은 아직 처리 전일 수 있으므로 incoming은 함수를 다 돈 뒤에 채운다.
+    struct ShadowPHI
+    {
+      PHINode *Orig;
+      PHINode *Base;
+      PHINode *Bound;
+      PHINode *Key;
+      PHINode *Lock;
+    };
+
+    // profile로 정한 검사 배치. Default는 profile이 없거나 profile에 없는 위치
+    enum SitePlacement
+    {
+      PlaceDefault,
+      PlaceHot,
+      PlaceWarm,
+      PlaceCold,
+    };
+
+    // 아직 삽입하지 않은 load/store 검사
+    struct CheckSite
+    {
+      Instruction *Inst;
+      Value *Ptr;
+      uint64_t Size;
+      Value *Base;
+      Value *Bound;
+      Value *Key;
+      Value *Lock;
+      SitePlacement Placement;
     };
-    std::map<Value *, Value *> MValueBaseMap;
-    std::map<Value *, Value *> MValueBoundMap;
+
+    // loop pre-header로 끌어올린 검사: 첫 주소 Lo부터 마지막 주소 Hi에 Size 바이트 접근까지
+    struct RangeCheck
+    {
+      Instruction *InsertPt;
+      Value *Lo;
+      Value *Hi;
+      uint64_t Size;
+      Value *Base;
+      Value *Bound;
+      Value *Key;
+      Value *Lock;
+      bool Inline;
+    };
+
+    // 함수 하나를 계측하는 동안만 쓰는 상태. instrumentFunction이 만들어 넘기고 끝나면 버린다.
+    struct FunctionContext
+    {
+      // 포인터 값 -> base/bound
+      DenseMap<Value *, Metadata> MValueMetadata;
+      // 포인터를 담은 구조체/배열 load -> load 시점에 metadata를 복사해 둔 stack 임시 영역
+      DenseMap<LoadInst *, AllocaInst *> AggregateSnapshots;
+      SmallVector<ShadowPHI, 16> ShadowPHIs;
+      SmallVector<CheckSite, 32> PendingChecks;
+      SmallVector<RangeCheck, 8> HoistedChecks;
+      // 함수 안에 free할 수 있는 호출이 있으면 temporal 검사를 합치거나 hoist하지 않는다
+      bool FunctionMayFree = false;
+    };
+
+    // -softbound-site-counters: 검사 위치 i의 횟수는 SiteCounters[i], 이름은 SiteKeys[i].
+    // 배열 크기는 모듈 끝에서 정해지므로 그 전까지는 [0 x i64] placeholder를 가리킨다.
+    GlobalVariable *SiteCounters = nullptr;
+    std::vector<std::string> SiteKeys;
+    Function *GlobalInit = nullptr;
+    // -softbound-profile: key -> 실행 횟수
+    StringMap<uint64_t> ProfileCounts;
+    unsigned NumPlacedSites[4] = {};
+    unsigned NumEmittedChecks = 0;
+    unsigned NumRedundantChecks = 0;
+    unsigned NumHoistedChecks = 0;
+    unsigned NumStaticSafeChecks = 0;
+    unsigned NumStaticViolations = 0;
+    unsigned NumTemporalChecks = 0;
 
     LLVMContext *C;
     const DataLayout *DL;
@@ -43,69 +245,174 @@ namespace
     FunctionCallee getMetaData;
     FunctionCallee boundCheck;
     FunctionCallee printMetadataTable;
+    FunctionCallee getMetadata;
+    StructType *MMetadataTy;
+    StructType *MBoundsTy;
+    Constant *PrimaryTable;
+    GlobalVariable *NullMetadata;
     FunctionCallee getBaseAddr;
     FunctionCallee getBoundAddr;
     FunctionCallee initTable;
+    FunctionCallee reportViolation;
+    // 원본 함수 -> base/bound 인자가 추가된 복제본
+    DenseMap<Function *, Function *> ClonedFunctions;
+    DenseMap<Function *, unsigned> CloneOrigArgCount;
+
+    FunctionCallee metadataCopy;
+    FunctionCallee metadataMove;
+    FunctionCallee metadataClear;
+    FunctionCallee softboundRealloc;
+    FunctionCallee softboundFree;
+    FunctionCallee softboundMunmap;
+    FunctionCallee shadowStackAllocate;
+    FunctionCallee shadowStackDeallocate;
+    FunctionCallee shadowStackStore;
+    FunctionCallee shadowStackStoreReturn;
+    FunctionCallee shadowStackLoadBase;
+    FunctionCallee shadowStackLoadBound;
+    // -softbound-temporal
+    Value *MPermanentKey = nullptr;
+    Value *MPermanentLock = nullptr;
+    StructType *MTemporalIdTy;
+    Constant *LockPool;
+    FunctionCallee setMetaDataTemporal;
+    FunctionCallee getTemporalId;
+    FunctionCallee boundCheckTemporal;
+    FunctionCallee reportViolationTemporal;
+    FunctionCallee lockAcquire;
+    FunctionCallee softboundFreeTemporal;
+    FunctionCallee softboundReallocTemporal;
+    FunctionCallee shadowStackStoreId;
+    FunctionCallee shadowStackStoreReturnId;
+    FunctionCallee shadowStackLoadKey;
+    FunctionCallee shadowStackLoadLock;
+    // -softbound-lowfat
+    Constant *LowFatClasses;
+    FunctionCallee lowfatMalloc;
+    FunctionCallee lowfatCalloc;
+    FunctionCallee getMetadataLowFat;
+    // 계측이 넣는 runtime 함수: 해제하지 않고, 위반 보고 말고는 항상 돌아온다.
+    // 그 밖의 호출은 시간 검사 중복 제거와 loop hoisting을 막는다
+    SmallPtrSet<Value *, 32> InstrumentationCallees;
 
     // For constants containing multiple pointers use getAssociatedBaseArray.
     
-    Value *getAssociatedBase(Value *pointer_operand)
+    // metadata를 모르는 포인터(상수, 계측되지 않은 출처)는 NULL base / 무한 bound로 본다
+    Metadata getAssociatedMetadata(FunctionContext &FC, Value *pointer_operand)
     {
-      if (!MValueBaseMap.count(pointer_operand))
+      auto It = FC.MValueMetadata.find(pointer_operand);
+      if (It != FC.MValueMetadata.end())
+        return It->second;
+      Metadata Result = {MVoidNullPtr, MInfiniteBoundPtr, MPermanentKey, MPermanentLock};
+      if (auto *Const = dyn_cast<Constant>(pointer_operand))
       {
-        if(auto *Const = dyn_cast<Constant>(pointer_operand)){
+        if (!getConstantMetadata(Const, Result) && ClTrace)
           errs() << "***Constant***\n";
-        }
-        else{
-          // Implement here.
-          MValueBaseMap[pointer_operand] = MVoidNullPtr;
-        }
       }
-      return MValueBaseMap[pointer_operand];
+      FC.MValueMetadata[pointer_operand] = Result;
+      return Result;
     }
 
-    Value *getAssociatedBound(Value *pointer_operand)
+    // 다른 모듈에서 정의가 바뀔 수 있는 global 은 크기를 믿을 수 없다
+    bool getGlobalSize(GlobalVariable *GV, uint64_t &Size)
     {
-      // TODO: 구조체 내부 out-of-bound 탐지 구현
-      if (MValueBoundMap.find(pointer_operand) == MValueBoundMap.end())
-      {
-        if(auto *Const = dyn_cast<Constant>(pointer_operand)){
-          errs() << "***Constant***\n";
-        }
-        else{
-          // Implement here.
-          MValueBoundMap[pointer_operand] = MInfiniteBoundPtr;
-        }
-      }
-      return MValueBoundMap[pointer_operand];
+      if (GV->isDeclaration() || GV->isInterposable() || !GV->getValueType()->isSized())
+        return false;
+      Size = DL->getTypeAllocSize(GV->getValueType()).getFixedSize();
+      return true;
     }
 
-    void dissociateBaseBound(Value *pointer_operand)
+    /*
+    global과 그 위의 constant GEP/bitcast는 DataLayout으로 base/bound를 상수로 계산한다.
+    가리키는 객체는 GEP offset과 상관없이 global 전체이므로 offset은 버리고 global까지 벗겨낸다.
+    결과도 ConstantExpr이라 trie 조회 없이 어느 함수에서나 쓸 수 있다.
+    */
+    bool getConstantMetadata(Constant *CV, Metadata &Result)
     {
-      if (MValueBaseMap.count(pointer_operand))
+      Value *Obj = CV->stripPointerCasts();
+      while (auto *CE = dyn_cast<ConstantExpr>(Obj))
       {
-        MValueBaseMap.erase(pointer_operand);
+        if (CE->getOpcode() != Instruction::GetElementPtr)
+          return false;
+        Obj = CE->getOperand(0)->stripPointerCasts();
       }
-      if (MValueBoundMap.count(pointer_operand))
+      auto *GV = dyn_cast<GlobalVariable>(Obj);
+      uint64_t Size;
+      if (!GV || GV->isThreadLocal() || !getGlobalSize(GV, Size))
+        return false;
+      Constant *Base = ConstantExpr::getPointerCast(GV, MVoidPtrTy);
+      Result.Base = Base;
+      Result.Bound = ConstantExpr::getGetElementPtr(Type::getInt8Ty(*C), Base,
+                                                    ConstantInt::get(MSizetTy, Size));
+      return true;
+    }
+
+    Value *getAssociatedBase(FunctionContext &FC, Value *pointer_operand)
+    {
+      return getAssociatedMetadata(FC, pointer_operand).Base;
+    }
+
+    Value *getAssociatedBound(FunctionContext &FC, Value *pointer_operand)
+    {
+      // TODO: 구조체 내부 out-of-bound 탐지 구현
+      return getAssociatedMetadata(FC, pointer_operand).Bound;
+    }
+
+    inline void associateMetadata(FunctionContext &FC, Value *Val, const Metadata &MD)
+    {
+      auto Inserted = FC.MValueMetadata.try_emplace(Val, MD);
+      if (!Inserted.second)
       {
-        MValueBoundMap.erase(pointer_operand);
+        if (ClTrace)
+          errs() << "disassociate\n";
+        Inserted.first->second = MD;
       }
-      assert((MValueBaseMap.count(pointer_operand) == 0) &&
-             "dissociating base failed\n");
-      assert((MValueBoundMap.count(pointer_operand) == 0) &&
-             "dissociating bound failed");
     }
-    inline void associateBaseBound(Value *Val, Value *Base,
-                                   Value *Bound)
+
+    // 해제되지 않는 객체(alloca, global)의 metadata
+    Metadata permanentMetadata(Value *Base, Value *Bound)
+    {
+      return {Base, Bound, MPermanentKey, MPermanentLock};
+    }
+
+    bool isPermanentKey(Value *Key)
+    {
+      auto *CI = dyn_cast_or_null<ConstantInt>(Key);
+      return CI && CI->getZExtValue() == PermanentKey;
+    }
+
+    bool isInstrumentationCall(const Instruction &I)
+    {
+      const auto *CB = dyn_cast<CallBase>(&I);
+      return CB && InstrumentationCallees.count(CB->getCalledOperand()->stripPointerCasts());
+    }
+
+    // 계측하지 않는 runtime 함수 말고는 어떤 호출이든 free에 닿을 수 있다고 본다
+    bool mayFree(const Instruction &I)
+    {
+      const auto *CB = dyn_cast<CallBase>(&I);
+      if (!CB || isa<IntrinsicInst>(CB))
+        return false;
+      return !isInstrumentationCall(I);
+    }
+
+    // exit/longjmp/예외 등으로 다음 명령어에 도달하지 못할 수 있는가
+    bool mayNotReturn(const Instruction &I)
+    {
+      return !isGuaranteedToTransferExecutionToSuccessor(&I) && !isInstrumentationCall(I);
+    }
+
+    // 같은 블록 안에서 From 뒤부터 To 앞까지 해제 가능한 호출이 없는가
+    bool noFreeBetween(Instruction *From, Instruction *To)
     {
-      if (MValueBaseMap.count(Val))
+      if (From->getParent() != To->getParent())
+        return false;
+      for (Instruction *I = From->getNextNode(); I && I != To; I = I->getNextNode())
       {
-        errs() << "disassociate\n";
-        dissociateBaseBound(Val);
+        if (mayFree(*I))
+          return false;
       }
-
-      MValueBaseMap[Val] = Base;
-      MValueBoundMap[Val] = Bound;
+      return true;
     }
 
     bool isTypeWithPointers(Type *Ty)
@@ -163,7 +470,444 @@ namespace
       return IRB.CreateBitCast(Ptr, MVoidPtrTy, Ptr->getName() + ".voidptr");
     }
 
-    void handle_alloca(Instruction &I)
+    uint64_t getAccessSize(Type *Ty)
+    {
+      return DL->getTypeStoreSize(Ty).getFixedSize();
+    }
+
+    // 접근 직전에 [access, access+size)가 [base, bound) 안에 있는지 검사한다.
+    // inline 모드에서는 비교 세 번과 분기만 남기고 위반 시에만 report 함수를 호출한다.
+    // 영구 key가 아닌 Key가 있으면 lock 값 load 한 번과 비교 하나를 같은 분기에 합친다.
+    void emitBoundCheck(Instruction *InsertPt, Value *Access, Value *Size,
+                        Value *Base, Value *Bound, Value *Key, Value *Lock,
+                        bool Inline = ClInlineChecks)
+    {
+      IRBuilder<> IRB(InsertPt);
+      bool Temporal = Key && !isPermanentKey(Key);
+      if (Temporal)
+        ++NumTemporalChecks;
+      if (!Inline)
+      {
+        if (Temporal)
+          IRB.CreateCall(boundCheckTemporal, {Base, Bound, Access, Size, Key, Lock});
+        else
+          IRB.CreateCall(boundCheck, {Base, Bound, Access, Size});
+        return;
+      }
+
+      Value *AccessInt = IRB.CreatePtrToInt(Access, MSizetTy);
+      Value *BaseInt = IRB.CreatePtrToInt(Base, MSizetTy);
+      Value *BoundInt = IRB.CreatePtrToInt(Bound, MSizetTy);
+      // access + size는 큰 size에서 wrap 하므로 남은 길이 bound - access와 비교한다(runtime의 out_of_bounds)
+      Value *Under = IRB.CreateICmpULT(AccessInt, BaseInt);
+      Value *Past = IRB.CreateICmpUGT(AccessInt, BoundInt);
+      Value *TooLong = IRB.CreateICmpUGT(Size, IRB.CreateSub(BoundInt, AccessInt));
+      Value *Over = IRB.CreateOr(Past, TooLong);
+      Value *Fail;
+      if (!Temporal)
+        Fail = IRB.CreateOr(Under, Over, "sb.fail");
+      else
+      {
+        // 해제 경로와 경쟁하는 읽기이므로 unordered atomic으로 읽는다
+        Value *LockPtr = IRB.CreateGEP(MSizetTy, LockPool, Lock);
+        LoadInst *Current = IRB.CreateAlignedLoad(MSizetTy, LockPtr, Align(8), "sb.lock");
+        Current->setAtomic(AtomicOrdering::Unordered);
+        Value *Stale = IRB.CreateICmpNE(Current, Key);
+        Fail = IRB.CreateOr(IRB.CreateOr(Under, Over), Stale, "sb.fail");
+      }
+
+      Instruction *ReportTerm = SplitBlockAndInsertIfThen(
+          Fail, InsertPt, false, MDBuilder(*C).createBranchWeights(1, 1 << 20));
+      IRBuilder<> ReportIRB(ReportTerm);
+      if (Temporal)
+        ReportIRB.CreateCall(reportViolationTemporal, {Base, Bound, Access, Size, Key, Lock});
+      else
+        ReportIRB.CreateCall(reportViolation, {Base, Bound, Access, Size});
+    }
+
+    // 검사는 바로 삽입하지 않고 함수 단위로 모아 두었다가 최적화 후 한 번에 삽입한다
+    void addBoundCheck(FunctionContext &FC, Instruction *I, Value *Ptr, Type *AccessTy,
+                       const Metadata &MD)
+    {
+      FC.PendingChecks.push_back({I, Ptr, getAccessSize(AccessTy), MD.Base, MD.Bound,
+                               MD.Key, MD.Lock, PlaceDefault});
+    }
+
+    // 함수 안에 해제 가능한 호출이 있고 key가 영구가 아니면, 검사 결과가 시점에 따라 달라진다
+    bool isTemporallyVolatile(FunctionContext &FC, const CheckSite &CS)
+    {
+      return FC.FunctionMayFree && CS.Key && !isPermanentKey(CS.Key);
+    }
+
+    /*
+    검사 위치의 profile key: "함수:파일:줄:열#n"
+    n은 같은 함수, 같은 위치의 검사 중 몇 번째인지로, debug 정보가 없으면 위치가 "?:0:0"이라 n만으로 구분된다.
+    fold/중복 제거 후, loop hoisting 전의 검사 목록 순서로 매기므로 같은 IR에 대해 항상 같은 key가 나온다.
+    */
+    std::string getSiteKey(Instruction *I, std::map<std::string, unsigned> &Ordinals)
+    {
+      std::string Key;
+      raw_string_ostream OS(Key);
+      OS << I->getFunction()->getName() << ":";
+      if (const DebugLoc &Loc = I->getDebugLoc())
+        OS << Loc->getFilename() << ":" << Loc.getLine() << ":" << Loc.getCol();
+      else
+        OS << "?:0:0";
+      OS.flush();
+      return Key + "#" + std::to_string(Ordinals[Key]++);
+    }
+
+    // 남은 load/store 검사마다 접근 직전에 counter를 1 증가시킨다.
+    // hoisting 여부와 상관없이 접근 횟수를 세어야 profile을 배치 결정에 다시 쓸 수 있다.
+    // 경쟁 조건에서 일부 증가가 빠질 수 있지만 profile 용도로는 충분하므로 원자적 연산은 쓰지 않는다.
+    void instrumentSiteCounters(FunctionContext &FC)
+    {
+      std::map<std::string, unsigned> Ordinals;
+      for (CheckSite &CS : FC.PendingChecks)
+      {
+        IRBuilder<> IRB(CS.Inst);
+        Value *Slot = IRB.CreateConstInBoundsGEP2_64(SiteCounters->getValueType(), SiteCounters,
+                                                     0, SiteKeys.size());
+        Value *Count = IRB.CreateLoad(MSizetTy, Slot);
+        IRB.CreateStore(IRB.CreateAdd(Count, ConstantInt::get(MSizetTy, 1)), Slot);
+        SiteKeys.push_back(getSiteKey(CS.Inst, Ordinals));
+      }
+    }
+
+    // "횟수 key" 줄로 된 profile을 읽는다. 같은 key가 여러 번 나오면(여러 실행을 이어 붙인 경우) 합친다.
+    void loadProfile()
+    {
+      ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(ClProfile);
+      if (!Buf)
+        report_fatal_error(Twine("cannot read -softbound-profile file ") + ClProfile + ": " +
+                           Buf.getError().message());
+      SmallVector<StringRef, 0> Lines;
+      (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+      for (StringRef Line : Lines)
+      {
+        Line = Line.trim();
+        if (Line.startswith("#"))
+          continue;
+        StringRef CountStr, Key;
+        std::tie(CountStr, Key) = Line.split(' ');
+        uint64_t Count;
+        if (Key.empty() || CountStr.getAsInteger(10, Count))
+        {
+          errs() << "softbound: warning: ignoring malformed profile line: " << Line << "\n";
+          continue;
+        }
+        ProfileCounts[Key.trim()] += Count;
+      }
+    }
+
+    void applyProfile(FunctionContext &FC)
+    {
+      std::map<std::string, unsigned> Ordinals;
+      for (CheckSite &CS : FC.PendingChecks)
+      {
+        auto It = ProfileCounts.find(getSiteKey(CS.Inst, Ordinals));
+        if (It == ProfileCounts.end())
+          CS.Placement = PlaceDefault;
+        else if (It->second >= ClProfileHotCount)
+          CS.Placement = PlaceHot;
+        else if (It->second < ClProfileColdCount)
+          CS.Placement = PlaceCold;
+        else
+          CS.Placement = PlaceWarm;
+        ++NumPlacedSites[CS.Placement];
+      }
+    }
+
+    bool shouldHoist(const CheckSite &CS)
+    {
+      return CS.Placement == PlaceHot || (CS.Placement == PlaceDefault && ClHoistLoopChecks);
+    }
+
+    bool shouldInline(SitePlacement Placement)
+    {
+      if (Placement == PlaceDefault)
+        return ClInlineChecks;
+      return Placement != PlaceCold;
+    }
+
+    // 모듈의 counter 배열과 key 문자열 표를 만들고 __global_init에서 runtime에 등록한다
+    void finalizeSiteCounters(Module &M)
+    {
+      if (!SiteCounters)
+        return;
+      uint64_t N = SiteKeys.size();
+      auto *CountersTy = ArrayType::get(MSizetTy, N);
+      auto *Counters = new GlobalVariable(M, CountersTy, false, GlobalValue::PrivateLinkage,
+                                          Constant::getNullValue(CountersTy), "sb.site_counters");
+      SiteCounters->replaceAllUsesWith(
+          ConstantExpr::getBitCast(Counters, SiteCounters->getType()));
+      SiteCounters->eraseFromParent();
+      SiteCounters = nullptr;
+
+      IRBuilder<> IRB(GlobalInit->getEntryBlock().getTerminator());
+      SmallVector<Constant *, 64> Names;
+      for (const std::string &Key : SiteKeys)
+        Names.push_back(IRB.CreateGlobalStringPtr(Key, "sb.site"));
+      auto *NamesTy = ArrayType::get(MVoidPtrTy, N);
+      auto *NamesGV = new GlobalVariable(M, NamesTy, true, GlobalValue::PrivateLinkage,
+                                         ConstantArray::get(NamesTy, Names), "sb.site_keys");
+      // runtime의 site_table { size_t *counters; const char **keys; size_t count; site_table *next; }
+      auto *TableTy = StructType::get(PointerType::getUnqual(MSizetTy),
+                                      PointerType::getUnqual(MVoidPtrTy), MSizetTy, MVoidPtrTy);
+      Constant *Zero = ConstantInt::get(MSizetTy, 0);
+      Constant *Fields[] = {
+          ConstantExpr::getInBoundsGetElementPtr(CountersTy, Counters, ArrayRef<Constant *>{Zero, Zero}),
+          ConstantExpr::getInBoundsGetElementPtr(NamesTy, NamesGV, ArrayRef<Constant *>{Zero, Zero}),
+          ConstantInt::get(MSizetTy, N), MVoidNullPtr};
+      auto *Table = new GlobalVariable(M, TableTy, false, GlobalValue::PrivateLinkage,
+                                       ConstantStruct::get(TableTy, Fields), "sb.site_table");
+      FunctionCallee RegisterSites = M.getOrInsertFunction(
+          "__softbound_register_sites",
+          FunctionType::get(Type::getVoidTy(M.getContext()), {MVoidPtrTy}, false));
+      IRB.CreateCall(RegisterSites, {IRB.CreateBitCast(Table, MVoidPtrTy)});
+      SiteKeys.clear();
+    }
+
+    // 크기가 고정된 alloca/global 에서 상수 offset 만큼 떨어진 주소는 컴파일 타임에 판정할 수 있다.
+    // 객체를 못 찾으면 false 를 반환한다.
+    bool getStaticObjectRange(Value *Ptr, Value *&Obj, int64_t &Offset,
+                              uint64_t &ObjSize)
+    {
+      APInt Off(DL->getIndexTypeSizeInBits(Ptr->getType()), 0);
+      Obj = Ptr->stripAndAccumulateConstantOffsets(*DL, Off, true);
+      if (auto *AI = dyn_cast<AllocaInst>(Obj))
+      {
+        auto *N = dyn_cast<ConstantInt>(AI->getArraySize());
+        if (!N)
+          return false;
+        ObjSize = DL->getTypeAllocSize(AI->getAllocatedType()).getFixedSize() *
+                  N->getZExtValue();
+      }
+      else if (auto *GV = dyn_cast<GlobalVariable>(Obj))
+      {
+        if (!getGlobalSize(GV, ObjSize))
+          return false;
+      }
+      else
+        return false;
+      Offset = Off.getSExtValue();
+      return true;
+    }
+
+    // 항상 범위 안인 검사는 제거하고, 항상 범위 밖인 검사는 경고를 출력한 뒤
+    // 검사 없이 report 호출로 바꾼다.
+    void foldStaticChecks(FunctionContext &FC)
+    {
+      unsigned Kept = 0;
+      for (unsigned i = 0; i < FC.PendingChecks.size(); ++i)
+      {
+        CheckSite CS = FC.PendingChecks[i];
+        Value *Obj;
+        int64_t Offset;
+        uint64_t ObjSize;
+        if (!getStaticObjectRange(CS.Ptr, Obj, Offset, ObjSize))
+        {
+          FC.PendingChecks[Kept++] = CS;
+          continue;
+        }
+        if (Offset >= 0 && (uint64_t)Offset + CS.Size <= ObjSize)
+        {
+          ++NumStaticSafeChecks;
+          continue;
+        }
+
+        ++NumStaticViolations;
+        errs() << "softbound: warning: ";
+        if (const DebugLoc &Loc = CS.Inst->getDebugLoc())
+        {
+          Loc.print(errs());
+          errs() << ": ";
+        }
+        errs() << "out-of-bound access of " << CS.Size << " bytes at offset "
+               << Offset << " into " << ObjSize << "-byte object ";
+        Obj->printAsOperand(errs(), false);
+        errs() << " in " << CS.Inst->getFunction()->getName() << "\n";
+
+        IRBuilder<> IRB(CS.Inst);
+        Value *Base = castToVoidPtr(Obj, IRB);
+        Value *Bound = IRB.CreateGEP(IRB.getInt8Ty(), Base, IRB.getInt64(ObjSize));
+        IRB.CreateCall(reportViolation, {Base, Bound, castToVoidPtr(CS.Ptr, IRB),
+                                         ConstantInt::get(MSizetTy, CS.Size)});
+      }
+      FC.PendingChecks.resize(Kept);
+    }
+
+    // 같은 포인터, 같은 base/bound 값에 대해 크기가 같거나 더 큰 검사가
+    // 지배(dominate)하고 있으면 뒤의 검사는 결과가 같으므로 제거한다.
+    // 시간 검사는 사이에 free가 끼어들 수 있으므로 같은 블록에서 해제 가능한 호출이 없을 때만 제거한다.
+    void eliminateRedundantChecks(FunctionContext &FC, DominatorTree &DT)
+    {
+      using CheckKey = std::tuple<Value *, Value *, Value *, Value *, Value *>;
+      DenseMap<CheckKey, SmallVector<unsigned, 4>> Groups;
+      for (unsigned i = 0; i < FC.PendingChecks.size(); ++i)
+      {
+        CheckSite &CS = FC.PendingChecks[i];
+        Groups[std::make_tuple(CS.Ptr->stripPointerCasts(), CS.Base, CS.Bound, CS.Key, CS.Lock)]
+            .push_back(i);
+      }
+
+      SmallVector<bool, 32> Redundant(FC.PendingChecks.size(), false);
+      for (auto &Group : Groups)
+      {
+        ArrayRef<unsigned> Idxs = Group.second;
+        for (unsigned j : Idxs)
+        {
+          for (unsigned i : Idxs)
+          {
+            // 지배 관계는 비대칭이므로 제거된 검사를 거쳐 가도 결국 남아 있는 검사가 j를 덮는다
+            if (i != j && FC.PendingChecks[i].Size >= FC.PendingChecks[j].Size &&
+                DT.dominates(FC.PendingChecks[i].Inst, FC.PendingChecks[j].Inst) &&
+                (!isTemporallyVolatile(FC, FC.PendingChecks[j]) ||
+                 noFreeBetween(FC.PendingChecks[i].Inst, FC.PendingChecks[j].Inst)))
+            {
+              Redundant[j] = true;
+              break;
+            }
+          }
+        }
+      }
+
+      unsigned Kept = 0;
+      for (unsigned i = 0; i < FC.PendingChecks.size(); ++i)
+      {
+        if (Redundant[i])
+          continue;
+        FC.PendingChecks[Kept++] = FC.PendingChecks[i];
+      }
+      NumRedundantChecks += FC.PendingChecks.size() - Kept;
+      FC.PendingChecks.resize(Kept);
+    }
+
+    // 루프 안의 affine 접근 {start,+,step}은 반복 전체에 걸친 주소 범위를 SCEV로 계산해
+    // pre-header에서 한 번만 검사한다. 범위를 증명할 수 없으면 반복마다 검사를 그대로 둔다.
+    void hoistLoopChecks(FunctionContext &FC, LoopInfo &LI, ScalarEvolution &SE, DominatorTree &DT)
+    {
+      SCEVExpander Expander(SE, *DL, "sb.range");
+      using RangeKey = std::tuple<BasicBlock *, const SCEV *, const SCEV *, Value *, Value *,
+                                  Value *, Value *>;
+      DenseMap<RangeKey, unsigned> Hoisted;
+      DenseMap<Loop *, bool> LoopMayFree;
+      // pre-header의 범위 검사는 모든 반복이 접근까지 도달한다고 가정한다.
+      // 반복 중 돌아오지 않을 수 있는 명령어(exit, longjmp, throw 가능한 호출)가 있으면 hoist 하지 않는다
+      DenseMap<Loop *, bool> LoopMayExit;
+      auto loopMayExit = [&](Loop *L) {
+        auto Inserted = LoopMayExit.try_emplace(L, false);
+        if (Inserted.second)
+        {
+          for (BasicBlock *BB : L->blocks())
+            for (Instruction &I : *BB)
+              Inserted.first->second |= mayNotReturn(I);
+        }
+        return Inserted.first->second;
+      };
+      auto loopMayFree = [&](Loop *L) {
+        auto Inserted = LoopMayFree.try_emplace(L, false);
+        if (Inserted.second)
+        {
+          for (BasicBlock *BB : L->blocks())
+            for (Instruction &I : *BB)
+              Inserted.first->second |= mayFree(I);
+        }
+        return Inserted.first->second;
+      };
+
+      unsigned Kept = 0;
+      for (unsigned i = 0; i < FC.PendingChecks.size(); ++i)
+      {
+        CheckSite CS = FC.PendingChecks[i];
+        Loop *L = LI.getLoopFor(CS.Inst->getParent());
+        const SCEVAddRecExpr *AR = nullptr;
+        const SCEV *BTC = nullptr;
+        if (shouldHoist(CS) && L && L->getLoopPreheader() && L->getLoopLatch() &&
+            L->getExitingBlock() == L->getLoopLatch() &&
+            DT.dominates(CS.Inst->getParent(), L->getLoopLatch()) &&
+            L->isLoopInvariant(CS.Base) && L->isLoopInvariant(CS.Bound) &&
+            (!CS.Key || (L->isLoopInvariant(CS.Key) && L->isLoopInvariant(CS.Lock))) &&
+            !(isTemporallyVolatile(FC, CS) && loopMayFree(L)) && !loopMayExit(L))
+        {
+          AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(CS.Ptr));
+          BTC = SE.getBackedgeTakenCount(L);
+        }
+        // inbounds GEP 주소는 wrap 하면 poison 이므로 NW 플래그가 없어도 범위가 연속이다
+        auto *GEP = dyn_cast<GEPOperator>(CS.Ptr->stripPointerCasts());
+        bool NoWrap = AR && (AR->hasNoSelfWrap() || (GEP && GEP->isInBounds()));
+        if (!AR || AR->getLoop() != L || !AR->isAffine() || !NoWrap ||
+            isa<SCEVCouldNotCompute>(BTC) ||
+            !isa<SCEVConstant>(AR->getStepRecurrence(SE)))
+        {
+          FC.PendingChecks[Kept++] = CS;
+          continue;
+        }
+
+        // 접근은 매 반복 실행되므로 첫 반복과 마지막 반복의 주소가 범위의 양 끝이다
+        const SCEV *First = AR->getStart();
+        const SCEV *Last = AR->evaluateAtIteration(BTC, SE);
+        bool Descending = cast<SCEVConstant>(AR->getStepRecurrence(SE))
+                              ->getAPInt()
+                              .isNegative();
+        const SCEV *Lo = Descending ? Last : First;
+        const SCEV *Hi = Descending ? First : Last;
+
+        BasicBlock *Preheader = L->getLoopPreheader();
+        Instruction *InsertPt = Preheader->getTerminator();
+        if (!isSafeToExpandAt(Lo, InsertPt, SE) ||
+            !isSafeToExpandAt(Hi, InsertPt, SE))
+        {
+          FC.PendingChecks[Kept++] = CS;
+          continue;
+        }
+
+        ++NumHoistedChecks;
+        RangeKey Key = std::make_tuple(Preheader, Lo, Hi, CS.Base, CS.Bound, CS.Key, CS.Lock);
+        auto It = Hoisted.find(Key);
+        if (It != Hoisted.end())
+        {
+          // 같은 범위가 이미 검사되면 더 넓은 접근 크기 하나로 합친다
+          RangeCheck &RC = FC.HoistedChecks[It->second];
+          RC.Size = std::max(RC.Size, CS.Size);
+          RC.Inline |= shouldInline(CS.Placement);
+          continue;
+        }
+        Value *LoPtr = Expander.expandCodeFor(Lo, MVoidPtrTy, InsertPt);
+        Value *HiPtr = Expander.expandCodeFor(Hi, MVoidPtrTy, InsertPt);
+        Hoisted[Key] = FC.HoistedChecks.size();
+        FC.HoistedChecks.push_back({InsertPt, LoPtr, HiPtr, CS.Size, CS.Base, CS.Bound,
+                                 CS.Key, CS.Lock, shouldInline(CS.Placement)});
+      }
+      FC.PendingChecks.resize(Kept);
+    }
+
+    void emitPendingChecks(FunctionContext &FC)
+    {
+      for (CheckSite &CS : FC.PendingChecks)
+      {
+        IRBuilder<> IRB(CS.Inst);
+        Value *Access = castToVoidPtr(CS.Ptr, IRB);
+        emitBoundCheck(CS.Inst, Access, ConstantInt::get(MSizetTy, CS.Size),
+                       CS.Base, CS.Bound, CS.Key, CS.Lock, shouldInline(CS.Placement));
+      }
+      NumEmittedChecks += FC.PendingChecks.size();
+      FC.PendingChecks.clear();
+
+      for (RangeCheck &RC : FC.HoistedChecks)
+      {
+        IRBuilder<> IRB(RC.InsertPt);
+        Value *LoInt = IRB.CreatePtrToInt(RC.Lo, MSizetTy);
+        Value *HiInt = IRB.CreatePtrToInt(RC.Hi, MSizetTy);
+        Value *Size = IRB.CreateAdd(IRB.CreateSub(HiInt, LoInt),
+                                    ConstantInt::get(MSizetTy, RC.Size), "sb.range.size");
+        emitBoundCheck(RC.InsertPt, RC.Lo, Size, RC.Base, RC.Bound, RC.Key, RC.Lock, RC.Inline);
+      }
+      NumEmittedChecks += FC.HoistedChecks.size();
+      FC.HoistedChecks.clear();
+    }
+
+    void handle_alloca(FunctionContext &FC, Instruction &I)
     {
       auto *AI = dyn_cast<AllocaInst>(&I);
       IRBuilder<> builder(AI->getNextNode());
@@ -185,10 +929,10 @@ namespace
       // Bound 주소 계산: GEP 명령어로 base 주소에 Idx를 더해 bound 주소 계산
       Value *boundGEP = builder.CreateGEP(AI->getAllocatedType(), AI, Idx, "mtmp");
       Value *bound = castToVoidPtr(boundGEP, builder); // Bound를 void*로 캐스팅
-      associateBaseBound(AI, base, bound);
+      associateMetadata(FC, AI, permanentMetadata(base, bound));
     };
 
-    void handle_store(Instruction &I)
+    void handle_store(FunctionContext &FC, Instruction &I)
     {
       StoreInst *SI = dyn_cast<StoreInst>(&I);
       IRBuilder<> builder(SI->getNextNode());
@@ -198,30 +942,79 @@ namespace
       Type *type = src->getType();
       Value *base = NULL;
       Value *bound = NULL;
-      Value *access = castToVoidPtr(dst, builder);
       if (!isTypeWithPointers(src->getType()))
       {
-        base = getAssociatedBase(dst);
-        bound = getAssociatedBound(dst);
-        builder.CreateCall(boundCheck,{base, bound, access});
+        addBoundCheck(FC, SI, dst, type, getAssociatedMetadata(FC, dst));
         return;
       }
-      base = getAssociatedBase(src);
-      bound = getAssociatedBound(src);
+      Value *access = castToVoidPtr(dst, builder);
+      base = getAssociatedBase(FC, src);
+      bound = getAssociatedBound(FC, src);
       if(!base || !bound){
         errs() << "metadata not exist allocating temporal data\n";
 
       }
       if (isa<PointerType>(type))
       {
-        builder.CreateCall(setMetaData, {access, base, bound});
+        if (ClTemporal)
+        {
+          Metadata MD = getAssociatedMetadata(FC, src);
+          builder.CreateCall(setMetaDataTemporal, {access, base, bound, MD.Key, MD.Lock});
+        }
+        else
+          builder.CreateCall(setMetaData, {access, base, bound});
         
       }
+      else
+      {
+        // 포인터를 포함한 구조체/배열 통째 저장: 원본이 메모리에서 읽은 값이면 load 시점의 slot을 한 번에 복사하고,
+        // 출처를 모르면 덮어쓴 영역의 metadata를 지운다
+        Value *Size = ConstantInt::get(MSizetTy, getAccessSize(type));
+        if (auto *LI = dyn_cast<LoadInst>(src))
+          builder.CreateCall(metadataCopy, {access, getAggregateMetadataSource(FC, LI, SI), Size});
+        else
+          builder.CreateCall(metadataClear, {access, Size});
+      }
 
       // vector의 경우 아직 고려하지 않음
     };
 
-    void handle_GEP(Instruction &I)
+    /*
+    구조체/배열 load LI의 값을 Store가 저장할 때 metadata를 복사해 올 주소.
+    같은 블록에서 load와 store 사이에 메모리를 쓰는 명령어가 없으면 load한 주소를 그대로 쓴다.
+    그렇지 않으면(예: t = *a; u = *b; *a = u; *b = t) 원본 slot이 그 사이 바뀌었을 수 있으므로,
+    load 직후 metadata를 stack 임시 영역에 복사해 두고 거기서 읽는다.
+    */
+    Value *getAggregateMetadataSource(FunctionContext &FC, LoadInst *LI, StoreInst *Store)
+    {
+      if (LI->getParent() == Store->getParent() && LI->comesBefore(Store))
+      {
+        bool Clobbered = false;
+        for (Instruction *I = LI->getNextNode(); I != Store; I = I->getNextNode())
+          Clobbered |= I->mayWriteToMemory() && !isInstrumentationCall(*I);
+        if (!Clobbered)
+        {
+          IRBuilder<> IRB(Store);
+          return castToVoidPtr(LI->getPointerOperand(), IRB);
+        }
+      }
+
+      AllocaInst *&Snapshot = FC.AggregateSnapshots[LI];
+      if (!Snapshot)
+      {
+        Function *F = LI->getFunction();
+        IRBuilder<> EntryIRB(&*F->getEntryBlock().getFirstInsertionPt());
+        Snapshot = EntryIRB.CreateAlloca(LI->getType(), nullptr, "sb.agg.metadata");
+        IRBuilder<> IRB(LI->getNextNode());
+        IRB.CreateCall(metadataCopy,
+                       {castToVoidPtr(Snapshot, IRB), castToVoidPtr(LI->getPointerOperand(), IRB),
+                        ConstantInt::get(MSizetTy, getAccessSize(LI->getType()))});
+      }
+      IRBuilder<> IRB(Store);
+      return castToVoidPtr(Snapshot, IRB);
+    }
+
+    void handle_GEP(FunctionContext &FC, Instruction &I)
     {
       GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(&I);
 
@@ -229,20 +1022,127 @@ namespace
       IRBuilder<> IRB(GEPI->getNextNode());
 
       // 기존의 포인터에 대한 메타데이터 가져오기
-      Value *base = getAssociatedBase(GEPPtrOp);
-      Value *bound = getAssociatedBound(GEPPtrOp);
-      if (!base || !bound)
+      Metadata MD = getAssociatedMetadata(FC, GEPPtrOp);
+      if (!MD.Base || !MD.Bound)
       {
         errs() << "Error: Base or Bound metadata not found for GEP!\n";
         return;
       }
       // GEP연산에서 base와 offset을 더해서 나온 access하는 주소를 구하는데, 여기서 base랑 bound를 구해서 access로 assoc 함
-      associateBaseBound(GEPI, base, bound); // %ptr = base+offset, %ptr에 대한 base, bound
+      associateMetadata(FC, GEPI, MD); // %ptr = base+offset, %ptr에 대한 base, bound
 
       // 새로운 GEP 명령어에 메타데이터 연결
     };
 
-    void handle_load(Instruction &I)
+    // Addr 위치에 저장된 포인터의 base/bound를 한 번의 trie 탐색으로 읽는다.
+    // inline 모드에서는 softbound.c의 get_primary_index/get_secondary_index와 같은 계산을 IR로 하고,
+    // secondary table이 없으면 분기 없이 0으로 채워진 slot을 읽는다.
+    // 시간 검사 모드에서는 같은 entry의 뒤쪽 16바이트에서 key/lock을 읽는다.
+    void loadMetadata(IRBuilder<> &IRB, Value *Addr, Metadata &data)
+    {
+      if (!ClInlineMetadataLoad)
+      {
+        Value *Pair = IRB.CreateCall(getMetadata, {Addr});
+        data.Base = IRB.CreateExtractValue(Pair, 0, "sb.base");
+        data.Bound = IRB.CreateExtractValue(Pair, 1, "sb.bound");
+        if (ClTemporal)
+        {
+          Value *Id = IRB.CreateCall(getTemporalId, {Addr});
+          data.Key = IRB.CreateExtractValue(Id, 0, "sb.key");
+          data.Lock = IRB.CreateExtractValue(Id, 1, "sb.lock");
+        }
+        return;
+      }
+
+      unsigned SlotShift = Log2_32(ClSlotBytes);
+      uint64_t PrimaryMask = (1ULL << (TrieAddressBits - TrieSecondaryBits - SlotShift)) - 1;
+      uint64_t SecondaryMask = (1ULL << TrieSecondaryBits) - 1;
+      Value *AddrInt = IRB.CreatePtrToInt(Addr, MSizetTy);
+      Value *PrimaryIdx = IRB.CreateAnd(
+          IRB.CreateLShr(AddrInt, SlotShift + TrieSecondaryBits), PrimaryMask);
+      Value *SecondaryIdx = IRB.CreateAnd(IRB.CreateLShr(AddrInt, SlotShift), SecondaryMask);
+
+      PointerType *EntryPtrTy = PointerType::getUnqual(MMetadataTy);
+      Value *Primary = IRB.CreateLoad(PointerType::getUnqual(EntryPtrTy), PrimaryTable,
+                                      "sb.primary");
+      LoadInst *Secondary = IRB.CreateAlignedLoad(
+          EntryPtrTy, IRB.CreateGEP(EntryPtrTy, Primary, PrimaryIdx), Align(8),
+          "sb.secondary");
+      Secondary->setAtomic(AtomicOrdering::Acquire);
+      Value *Entry = IRB.CreateGEP(MMetadataTy, Secondary, SecondaryIdx);
+      Entry = IRB.CreateSelect(IRB.CreateIsNull(Secondary), NullMetadata, Entry);
+
+      Value *BaseInt, *BoundInt;
+      loadMetadataWord(IRB, Entry, BaseInt, BoundInt, "sb.metadata");
+      data.Base = IRB.CreateIntToPtr(BaseInt, MVoidPtrTy, "sb.base");
+      data.Bound = IRB.CreateIntToPtr(BoundInt, MVoidPtrTy, "sb.bound");
+      if (!ClTemporal)
+        return;
+      Value *IdPtr = IRB.CreateStructGEP(MMetadataTy, Entry, 2);
+      loadMetadataWord(IRB, IdPtr, data.Key, data.Lock, "sb.temporal");
+      data.Key->setName("sb.key");
+      data.Lock->setName("sb.lock");
+    }
+
+    // Ptr의 16바이트를 정렬된 vector load 한 번으로 읽어 두 word로 나눈다.
+    // x86-64에서 정렬된 16바이트 SSE load는 한 번의 접근이라 runtime이 16바이트 단위로 쓰는 쌍이
+    // 찢어지지 않는다(softbound.c의 멀티스레드 설명 참고). cmpxchg16b와 달리 쓰지 않으므로
+    // 상수인 null slot도 읽을 수 있고 metadata page를 dirty로 만들지 않는다.
+    void loadMetadataWord(IRBuilder<> &IRB, Value *Ptr, Value *&Lo, Value *&Hi, const Twine &Name)
+    {
+      auto *PairTy = FixedVectorType::get(MSizetTy, 2);
+      Value *Pair = IRB.CreateAlignedLoad(
+          PairTy, IRB.CreateBitCast(Ptr, PointerType::getUnqual(PairTy)), Align(16), Name);
+      Lo = IRB.CreateExtractElement(Pair, (uint64_t)0);
+      Hi = IRB.CreateExtractElement(Pair, (uint64_t)1);
+    }
+
+    // load한 포인터 Ptr이 low-fat 영역 안이면 값에서 base/bound를 계산하고, 아니면 Addr의 trie를 읽는다.
+    // 영역 번호 index = ptr >> LowFatRegionBits가 1 이상 __softbound_lowfat_classes 이하이면 low-fat 블록이다.
+    void loadLowFatMetadata(IRBuilder<> &IRB, Value *Ptr, Value *Addr, Metadata &data)
+    {
+      Value *PtrVoid = castToVoidPtr(Ptr, IRB);
+      if (!ClInlineMetadataLoad)
+      {
+        Value *Pair = IRB.CreateCall(getMetadataLowFat, {Addr, PtrVoid});
+        data.Base = IRB.CreateExtractValue(Pair, 0, "sb.base");
+        data.Bound = IRB.CreateExtractValue(Pair, 1, "sb.bound");
+        return;
+      }
+
+      Instruction *InsertPt = &*IRB.GetInsertPoint();
+      Value *PtrInt = IRB.CreatePtrToInt(PtrVoid, MSizetTy);
+      Value *Index = IRB.CreateLShr(PtrInt, LowFatRegionBits, "sb.lowfat.index");
+      Value *Classes = IRB.CreateLoad(MSizetTy, LowFatClasses, "sb.lowfat.classes");
+      Value *IsLowFat = IRB.CreateICmpULT(IRB.CreateSub(Index, ConstantInt::get(MSizetTy, 1)),
+                                          Classes, "sb.lowfat");
+      Instruction *ThenTerm, *ElseTerm;
+      SplitBlockAndInsertIfThenElse(IsLowFat, InsertPt, &ThenTerm, &ElseTerm);
+
+      IRBuilder<> LowFat(ThenTerm);
+      Value *Size = LowFat.CreateShl(ConstantInt::get(MSizetTy, 1),
+                                     LowFat.CreateAdd(Index, ConstantInt::get(MSizetTy, LowFatMinShift - 1)));
+      Value *BaseInt = LowFat.CreateAnd(PtrInt, LowFat.CreateNeg(Size));
+      Value *LowFatBase = LowFat.CreateIntToPtr(BaseInt, MVoidPtrTy, "sb.lowfat.base");
+      Value *LowFatBound =
+          LowFat.CreateIntToPtr(LowFat.CreateAdd(BaseInt, Size), MVoidPtrTy, "sb.lowfat.bound");
+
+      IRBuilder<> Trie(ElseTerm);
+      Metadata TrieData;
+      loadMetadata(Trie, Addr, TrieData);
+
+      IRBuilder<> Merge(InsertPt);
+      PHINode *Base = Merge.CreatePHI(MVoidPtrTy, 2, "sb.base");
+      Base->addIncoming(LowFatBase, ThenTerm->getParent());
+      Base->addIncoming(TrieData.Base, ElseTerm->getParent());
+      PHINode *Bound = Merge.CreatePHI(MVoidPtrTy, 2, "sb.bound");
+      Bound->addIncoming(LowFatBound, ThenTerm->getParent());
+      Bound->addIncoming(TrieData.Bound, ElseTerm->getParent());
+      data.Base = Base;
+      data.Bound = Bound;
+    }
+
+    void handle_load(FunctionContext &FC, Instruction &I)
     {
       LoadInst *LI = dyn_cast<LoadInst>(&I);
       Type *LoadTy = LI->getType();
@@ -251,31 +1151,34 @@ namespace
       int typeID = LoadTy->getTypeID();
 
       Value *pointer_operand = LI->getPointerOperand();
-      Value *base = getAssociatedBase(pointer_operand);
-      Value *bound = getAssociatedBound(pointer_operand);
+      Metadata MD = getAssociatedMetadata(FC, pointer_operand);
+      Value *base = MD.Base;
+      Value *bound = MD.Bound;
       Instruction *new_inst = getNextInstruction(LI);
       IRBuilder<> IRB(new_inst);
-      Value *access = castToVoidPtr(pointer_operand, IRB);
 
       if (isa<PointerType>(LoadTy))
       {
-        if (!MValueBaseMap.count(LI) && !MValueBoundMap.count(LI))
+        if (!FC.MValueMetadata.count(LI))
         {
           
           Value *loadsrc = castToVoidPtr(pointer_operand, IRB);
-          data.Base = IRB.CreateCall(getBaseAddr, {loadsrc});
-          data.Bound = IRB.CreateCall(getBoundAddr, {loadsrc});
-          associateBaseBound(LI, data.Base, data.Bound);
+          if (ClLowFat)
+            loadLowFatMetadata(IRB, LI, loadsrc, data);
+          else
+            loadMetadata(IRB, loadsrc, data);
+          associateMetadata(FC, LI, data);
         }
       }
       if(!base || !bound){
         errs() << *LI << "\n";
       }
-      IRB.CreateCall(printMetadata, {base,bound});
-      IRB.CreateCall(boundCheck, {base, bound, access});
+      if (ClTrace)
+        IRB.CreateCall(printMetadata, {base,bound});
+      addBoundCheck(FC, LI, pointer_operand, LoadTy, MD);
     };
 
-    void handle_bitcast(Instruction &I)
+    void handle_bitcast(FunctionContext &FC, Instruction &I)
     {
       BitCastInst *BCI = dyn_cast<BitCastInst>(&I);
       if (!BCI)
@@ -287,51 +1190,605 @@ namespace
 
       // 원본 포인터의 메타데이터 가져오기
       // errs() << "assoc in bitcast : " << *SrcPtr << "\n";
-      Value *Base = getAssociatedBase(SrcPtr);
-      Value *Bound = getAssociatedBound(SrcPtr);
+      Metadata MD = getAssociatedMetadata(FC, SrcPtr);
 
-      if (!Base || !Bound)
+      if (!MD.Base || !MD.Bound)
       {
         errs() << "Error: Base or Bound metadata not found for bitcast!\n";
         return;
       }
 
       // 새로운 포인터에 메타데이터 연관
-      associateBaseBound(DstPtr, Base, Bound);
+      associateMetadata(FC, DstPtr, MD);
     }
 
-    void handle_call(Instruction &I){
+    // 1단계: 빈 shadow PHI를 만들어 두고 바로 연관시켜 루프 안의 사용처가 이를 참조하게 한다
+    void handle_phi(FunctionContext &FC, Instruction &I)
+    {
+      PHINode *PN = cast<PHINode>(&I);
+      if (!isa<PointerType>(PN->getType()))
+        return;
+      IRBuilder<> IRB(PN);
+      PHINode *Base = IRB.CreatePHI(MVoidPtrTy, PN->getNumIncomingValues(), PN->getName() + ".base");
+      PHINode *Bound = IRB.CreatePHI(MVoidPtrTy, PN->getNumIncomingValues(), PN->getName() + ".bound");
+      PHINode *Key = nullptr;
+      PHINode *Lock = nullptr;
+      if (ClTemporal)
+      {
+        Key = IRB.CreatePHI(MSizetTy, PN->getNumIncomingValues(), PN->getName() + ".key");
+        Lock = IRB.CreatePHI(MSizetTy, PN->getNumIncomingValues(), PN->getName() + ".lock");
+      }
+      associateMetadata(FC, PN, {Base, Bound, Key, Lock});
+      FC.ShadowPHIs.push_back({PN, Base, Bound, Key, Lock});
+    }
+
+    // 2단계: 모든 값의 metadata가 정해진 뒤 incoming을 채운다
+    void completeShadowPHIs(FunctionContext &FC)
+    {
+      for (ShadowPHI &SP : FC.ShadowPHIs)
+      {
+        for (unsigned i = 0, e = SP.Orig->getNumIncomingValues(); i != e; ++i)
+        {
+          Metadata Incoming = getAssociatedMetadata(FC, SP.Orig->getIncomingValue(i));
+          BasicBlock *Pred = SP.Orig->getIncomingBlock(i);
+          SP.Base->addIncoming(Incoming.Base, Pred);
+          SP.Bound->addIncoming(Incoming.Bound, Pred);
+          if (SP.Key)
+          {
+            SP.Key->addIncoming(Incoming.Key, Pred);
+            SP.Lock->addIncoming(Incoming.Lock, Pred);
+          }
+        }
+      }
+      simplifyShadowPHIs(FC);
+      FC.ShadowPHIs.clear();
+    }
+
+    // 모든 incoming이 같은 값(자기 자신 제외)인 shadow PHI는 그 값으로 바꾼다.
+    // 포인터를 증가시키는 루프의 base/bound는 대부분 loop 불변이 되어 검사를 hoist 할 수 있다.
+    // 지운 PHI를 쓰던 shadow PHI만 다시 보고, metadata 표와 대기 중인 검사는 끝에 한 번만 고친다.
+    void simplifyShadowPHIs(FunctionContext &FC)
+    {
+      SmallVector<PHINode *, 64> Worklist;
+      SmallPtrSet<PHINode *, 32> Live;
+      for (ShadowPHI &SP : FC.ShadowPHIs)
+      {
+        for (PHINode *PN : {SP.Base, SP.Bound, SP.Key, SP.Lock})
+        {
+          if (PN && Live.insert(PN).second)
+            Worklist.push_back(PN);
+        }
+      }
+
+      DenseMap<Value *, Value *> Replaced;
+      while (!Worklist.empty())
+      {
+        PHINode *PN = Worklist.pop_back_val();
+        if (!Live.count(PN))
+          continue;
+        Value *V = PN->hasConstantValue();
+        if (!V || isa<UndefValue>(V))
+          continue;
+        for (User *U : PN->users())
+        {
+          auto *UserPN = dyn_cast<PHINode>(U);
+          if (UserPN && UserPN != PN && Live.count(UserPN))
+            Worklist.push_back(UserPN);
+        }
+        PN->replaceAllUsesWith(V);
+        PN->eraseFromParent();
+        Live.erase(PN);
+        Replaced[PN] = V;
+      }
+      if (Replaced.empty())
+        return;
+
+      // 지운 PHI가 다른 지운 PHI로 바뀌었을 수 있으므로 끝까지 따라간다
+      auto resolve = [&](Value *&V) {
+        auto It = Replaced.find(V);
+        while (It != Replaced.end())
+        {
+          V = It->second;
+          It = Replaced.find(V);
+        }
+      };
+      for (auto &Entry : FC.MValueMetadata)
+      {
+        for (Value *&V : {std::ref(Entry.second.Base), std::ref(Entry.second.Bound),
+                          std::ref(Entry.second.Key), std::ref(Entry.second.Lock)})
+          resolve(V);
+      }
+      for (CheckSite &CS : FC.PendingChecks)
+      {
+        for (Value *&V : {std::ref(CS.Base), std::ref(CS.Bound), std::ref(CS.Key),
+                          std::ref(CS.Lock)})
+          resolve(V);
+      }
+    }
+
+    void handle_select(FunctionContext &FC, Instruction &I)
+    {
+      SelectInst *SI = cast<SelectInst>(&I);
+      if (!isa<PointerType>(SI->getType()))
+        return;
+      Metadata True = getAssociatedMetadata(FC, SI->getTrueValue());
+      Metadata False = getAssociatedMetadata(FC, SI->getFalseValue());
+      IRBuilder<> IRB(SI->getNextNode());
+      Value *Base = IRB.CreateSelect(SI->getCondition(), True.Base, False.Base,
+                                     SI->getName() + ".base");
+      Value *Bound = IRB.CreateSelect(SI->getCondition(), True.Bound, False.Bound,
+                                      SI->getName() + ".bound");
+      Metadata MD = {Base, Bound};
+      if (ClTemporal)
+      {
+        MD.Key = IRB.CreateSelect(SI->getCondition(), True.Key, False.Key, SI->getName() + ".key");
+        MD.Lock = IRB.CreateSelect(SI->getCondition(), True.Lock, False.Lock,
+                                   SI->getName() + ".lock");
+      }
+      associateMetadata(FC, SI, MD);
+    }
+
+    // 호출 전에 shadow stack frame을 만들고 포인터 인자의 base/bound를 넣는다.
+    // 반환값이 포인터면 호출 후 반환 slot에서 metadata를 읽는다.
+    // 복제된 함수 호출은 포인터 인자마다 base/bound를 추가 인자로 넘기는 호출로 바꾼다
+    void rewriteClonedCall(FunctionContext &FC, CallInst *CI, Function *Clone)
+    {
+      SmallVector<Value *, 8> Args(CI->args());
+      for (Value *Arg : CI->args())
+      {
+        if (!isa<PointerType>(Arg->getType()))
+          continue;
+        Metadata MD = getAssociatedMetadata(FC, Arg);
+        Args.push_back(MD.Base);
+        Args.push_back(MD.Bound);
+        if (ClTemporal)
+        {
+          Args.push_back(MD.Key);
+          Args.push_back(MD.Lock);
+        }
+      }
+      CallInst *NewCI = CallInst::Create(Clone, Args, "", CI);
+      NewCI->setCallingConv(CI->getCallingConv());
+      NewCI->setAttributes(CI->getAttributes());
+      NewCI->setTailCallKind(CI->getTailCallKind());
+      NewCI->setDebugLoc(CI->getDebugLoc());
+      NewCI->takeName(CI);
+      CI->replaceAllUsesWith(NewCI);
+      CI->eraseFromParent();
+    }
+
+    // 할당 함수 호출이면 할당 크기를 계산하고, 아니면 nullptr
+    Value *getAllocationSize(CallInst *CI, StringRef Name, IRBuilder<> &IRB)
+    {
+      if (Name == "malloc" || Name == "_Znwm" || Name == "_Znam" ||
+          Name == "_ZnwmRKSt9nothrow_t" || Name == "_ZnamRKSt9nothrow_t")
+        return CI->getArgOperand(0);
+      if (Name == "realloc" || Name == "aligned_alloc")
+        return CI->getArgOperand(1);
+      if (Name == "calloc")
+        return IRB.CreateMul(CI->getArgOperand(0), CI->getArgOperand(1));
+      return nullptr;
+    }
+
+    // CI를 같은 자리의 Callee(Args) 호출로 바꾸고, 원래 사용처가 쓰게 된 값을 반환한다
+    Value *replaceCall(CallInst *CI, FunctionCallee Callee, ArrayRef<Value *> Args)
+    {
+      IRBuilder<> IRB(CI);
+      CallInst *NewCI = IRB.CreateCall(Callee, Args);
+      NewCI->setDebugLoc(CI->getDebugLoc());
+      Value *Result = NewCI;
+      if (!CI->getType()->isVoidTy())
+      {
+        NewCI->takeName(CI);
+        Result = IRB.CreateBitCast(NewCI, CI->getType());
+        CI->replaceAllUsesWith(Result);
+      }
+      CI->eraseFromParent();
+      return Result;
+    }
+
+    // heap 할당 결과는 [ptr, ptr+size)를 바로 base/bound로 연결한다. 실패(NULL)하면 bound도 NULL.
+    // realloc/free/munmap은 블록 안에 저장된 포인터의 metadata를 옮기거나 지우는 runtime wrapper로 바꾼다.
+    // 시간 검사 모드에서는 할당마다 lock을 받고, free/realloc은 포인터의 key/lock으로 해제를 검증한다.
+    bool handle_allocation(FunctionContext &FC, CallInst *CI, Function *Callee)
+    {
+      StringRef Name = Callee->getName();
+      if (Name == "free")
+      {
+        if (ClTemporal)
+        {
+          IRBuilder<> IRB(CI);
+          Value *Ptr = CI->getArgOperand(0);
+          Metadata MD = getAssociatedMetadata(FC, Ptr);
+          replaceCall(CI, softboundFreeTemporal, {castToVoidPtr(Ptr, IRB), MD.Key, MD.Lock});
+        }
+        else
+          CI->setCalledFunction(softboundFree);
+        return true;
+      }
+      if (Name == "munmap")
+      {
+        CI->setCalledFunction(softboundMunmap);
+        return true;
+      }
+
+      IRBuilder<> IRB(getNextInstruction(CI));
+      Value *Size = getAllocationSize(CI, Name, IRB);
+      if (!Size)
+        return false;
+      Value *Result = CI;
+      if (ClLowFat && Name == "malloc")
+        CI->setCalledFunction(lowfatMalloc);
+      else if (ClLowFat && Name == "calloc")
+        CI->setCalledFunction(lowfatCalloc);
+      else if (Name == "realloc" && ClTemporal)
+      {
+        IRBuilder<> Before(CI);
+        Value *Ptr = CI->getArgOperand(0);
+        Metadata MD = getAssociatedMetadata(FC, Ptr);
+        Result = replaceCall(CI, softboundReallocTemporal,
+                             {castToVoidPtr(Ptr, Before), Before.CreateZExtOrTrunc(Size, MSizetTy),
+                              MD.Key, MD.Lock});
+      }
+      else if (Name == "realloc")
+        CI->setCalledFunction(softboundRealloc);
+
+      Value *Base = castToVoidPtr(Result, IRB);
+      Value *End = IRB.CreateGEP(IRB.getInt8Ty(), Base,
+                                 IRB.CreateZExtOrTrunc(Size, MSizetTy), "heap.bound");
+      Value *Bound = IRB.CreateSelect(IRB.CreateIsNull(Base), MVoidNullPtr, End);
+      Metadata MD = {Base, Bound};
+      if (ClTemporal)
+      {
+        Value *Id = IRB.CreateCall(lockAcquire, {Base});
+        MD.Key = IRB.CreateExtractValue(Id, 0, "heap.key");
+        MD.Lock = IRB.CreateExtractValue(Id, 1, "heap.lock");
+      }
+      associateMetadata(FC, Result, MD);
+      return true;
+    }
+
+    // memcpy/memmove/memset: 양쪽 범위를 길이만큼 검사하고, 포인터 metadata를 구간 단위로 복사/삭제한다
+    void handle_mem_intrinsic(FunctionContext &FC, MemIntrinsic *MI)
+    {
+      IRBuilder<> IRB(MI);
+      Value *Len = IRB.CreateZExtOrTrunc(MI->getLength(), MSizetTy);
+      Value *Dst = castToVoidPtr(MI->getDest(), IRB);
+      auto *MTI = dyn_cast<MemTransferInst>(MI);
+      Value *Src = MTI ? castToVoidPtr(MTI->getSource(), IRB) : nullptr;
+
+      // inline check가 블록을 나누기 전에 metadata 갱신 호출부터 넣는다
+      IRBuilder<> After(getNextInstruction(MI));
+      if (MTI)
+        After.CreateCall(isa<MemMoveInst>(MTI) ? metadataMove : metadataCopy,
+                         {Dst, Src, Len});
+      else
+        After.CreateCall(metadataClear, {Dst, Len});
+
+      Metadata DstMD = getAssociatedMetadata(FC, MI->getDest());
+      emitBoundCheck(MI, Dst, Len, DstMD.Base, DstMD.Bound, DstMD.Key, DstMD.Lock);
+      ++NumEmittedChecks;
+      if (MTI)
+      {
+        Metadata SrcMD = getAssociatedMetadata(FC, MTI->getSource());
+        emitBoundCheck(MI, Src, Len, SrcMD.Base, SrcMD.Bound, SrcMD.Key, SrcMD.Lock);
+        ++NumEmittedChecks;
+      }
+    }
+
+    void handle_call(FunctionContext &FC, Instruction &I)
+    {
       CallInst *CI = dyn_cast<CallInst>(&I);
-      if(!CI->getCalledFunction()->getName().equals("func")) return;
-      errs() << CI->arg_size() << "\n";
-      for (unsigned idx = 0; idx < CI->arg_size(); ++idx) {
-        Value *arg = CI->getArgOperand(idx);
+      if (auto *MI = dyn_cast<MemIntrinsic>(CI))
+      {
+        handle_mem_intrinsic(FC, MI);
+        return;
+      }
+      if (isa<IntrinsicInst>(CI) || CI->isInlineAsm())
+        return;
+      if (Function *Callee = CI->getCalledFunction())
+      {
+        auto It = ClonedFunctions.find(Callee);
+        if (It != ClonedFunctions.end())
+        {
+          rewriteClonedCall(FC, CI, It->second);
+          return;
+        }
+        if (Callee->isDeclaration() && handle_allocation(FC, CI, Callee))
+          return;
+      }
 
-        // Retrieve existing metadata for the argument
-        Value *base = getAssociatedBase(arg);
-        Value *bound = getAssociatedBound(arg);
+      SmallVector<Value *, 4> PtrArgs;
+      for (Value *Arg : CI->args())
+      {
+        if (isa<PointerType>(Arg->getType()))
+          PtrArgs.push_back(Arg);
+      }
+      bool ReturnsPtr = isa<PointerType>(CI->getType());
+      if (PtrArgs.empty() && !ReturnsPtr)
+        return;
 
-        errs() << "Argument: " << *arg << "\n";
-        errs() << "Base is :" << base << " " << *base << " "<< &base <<"\n";
+      IRBuilder<> IRB(CI);
+      Value *Callee = castToVoidPtr(CI->getCalledOperand(), IRB);
+      IRB.CreateCall(shadowStackAllocate,
+                     {ConstantInt::get(MSizetTy, PtrArgs.size()), Callee});
+      for (unsigned idx = 0; idx < PtrArgs.size(); ++idx)
+      {
+        Metadata MD = getAssociatedMetadata(FC, PtrArgs[idx]);
+        Value *Idx = ConstantInt::get(MSizetTy, idx + 1);
+        IRB.CreateCall(shadowStackStore, {Idx, MD.Base, MD.Bound});
+        if (ClTemporal)
+          IRB.CreateCall(shadowStackStoreId, {Idx, MD.Key, MD.Lock});
+      }
 
-        // Check if the Base or Bound is Dummy Metadata
-        if (base == MVoidNullPtr || bound == MInfiniteBoundPtr) {
-            errs() << "Dummy Metadata detected for argument: " << *arg << "\n";
+      IRBuilder<> After(getNextInstruction(CI));
+      if (ReturnsPtr)
+      {
+        Value *RetIdx = ConstantInt::get(MSizetTy, 0);
+        Value *Base = After.CreateCall(shadowStackLoadBase, {RetIdx, Callee});
+        Value *Bound = After.CreateCall(shadowStackLoadBound, {RetIdx, Callee});
+        Metadata MD = {Base, Bound};
+        if (ClTemporal)
+        {
+          MD.Key = After.CreateCall(shadowStackLoadKey, {RetIdx, Callee});
+          MD.Lock = After.CreateCall(shadowStackLoadLock, {RetIdx, Callee});
+        }
+        associateMetadata(FC, CI, MD);
+      }
+      After.CreateCall(shadowStackDeallocate);
+    }
 
-            // Find the corresponding function argument in the callee
-            Function *calledFunction = CI->getCalledFunction();
-            if (!calledFunction)
-                continue;
+    void handle_ret(FunctionContext &FC, Instruction &I)
+    {
+      ReturnInst *RI = dyn_cast<ReturnInst>(&I);
+      Value *RetVal = RI->getReturnValue();
+      if (!RetVal || !isa<PointerType>(RetVal->getType()))
+        return;
+      IRBuilder<> IRB(RI);
+      Metadata MD = getAssociatedMetadata(FC, RetVal);
+      Value *Self = castToVoidPtr(RI->getFunction(), IRB);
+      IRB.CreateCall(shadowStackStoreReturn, {Self, MD.Base, MD.Bound});
+      if (ClTemporal)
+        IRB.CreateCall(shadowStackStoreReturnId, {Self, MD.Key, MD.Lock});
+    }
 
-            Argument *calleeArg = calledFunction->arg_begin() + idx;
+    // 함수 진입 시 호출자가 shadow stack에 넣어 둔 포인터 인자의 metadata를 읽는다
+    void handle_prologue(FunctionContext &FC, Function &F)
+    {
+      if (CloneOrigArgCount.count(&F))
+      {
+        // 복제된 함수는 원래 인자 뒤에 포인터 인자마다 (base, bound[, key, lock])가 붙어 있다
+        auto Extra = F.arg_begin() + CloneOrigArgCount[&F];
+        for (Argument &Arg : make_range(F.arg_begin(), F.arg_begin() + CloneOrigArgCount[&F]))
+        {
+          if (!isa<PointerType>(Arg.getType()))
+            continue;
+          Metadata MD;
+          MD.Base = &*Extra++;
+          MD.Bound = &*Extra++;
+          if (ClTemporal)
+          {
+            MD.Key = &*Extra++;
+            MD.Lock = &*Extra++;
+          }
+          associateMetadata(FC, &Arg, MD);
+        }
+        return;
+      }
 
-            // Update the metadata for the callee's argument
-            associateBaseBound(calleeArg, base, bound);
-            errs() << "Updated metadata for callee argument: " << *calleeArg << "\n";
+      IRBuilder<> IRB(&*F.getEntryBlock().getFirstInsertionPt());
+      Value *Self = castToVoidPtr(&F, IRB);
+      unsigned idx = 0;
+      for (Argument &Arg : F.args())
+      {
+        if (!isa<PointerType>(Arg.getType()))
+          continue;
+        Value *Idx = ConstantInt::get(MSizetTy, ++idx);
+        Value *Base = IRB.CreateCall(shadowStackLoadBase, {Idx, Self});
+        Value *Bound = IRB.CreateCall(shadowStackLoadBound, {Idx, Self});
+        Metadata MD = {Base, Bound};
+        if (ClTemporal)
+        {
+          MD.Key = IRB.CreateCall(shadowStackLoadKey, {Idx, Self});
+          MD.Lock = IRB.CreateCall(shadowStackLoadLock, {Idx, Self});
         }
+        associateMetadata(FC, &Arg, MD);
+      }
     }
 
-      
+    /*
+    runtime bitcode를 모듈에 링크한다.
+    - 함수는 linkonce_odr로 바꿔 여러 모듈이 각자 링크해도 최종 링크에서 하나로 합쳐지게 한다.
+    - 변경 가능한 전역(trie, shadow stack)은 선언으로 바꿔 libsoftbound.so의 정의 하나를 공유한다.
+      모듈마다 자기 복사본을 가지면 metadata가 모듈 사이에 전달되지 않는다.
+    */
+    void linkRuntimeBitcode(Module &M)
+    {
+      SMDiagnostic Err;
+      std::unique_ptr<Module> Runtime = parseIRFile(ClRuntimeBitcode, Err, M.getContext());
+      if (!Runtime)
+      {
+        Err.print("softbound", errs());
+        report_fatal_error("cannot load -softbound-runtime-bc file");
+      }
+      for (GlobalVariable &GV : Runtime->globals())
+      {
+        if (GV.isDeclaration() || GV.isConstant())
+          continue;
+        if (GV.hasLocalLinkage())
+          report_fatal_error("softbound runtime bitcode has a private mutable global: " +
+                             GV.getName());
+        GV.setInitializer(nullptr);
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+        GV.setComdat(nullptr);
+      }
+      for (Function &F : *Runtime)
+      {
+        if (F.isDeclaration())
+          continue;
+        F.addFnAttr(RuntimeFnAttr);
+      }
+      Runtime->setDataLayout(M.getDataLayout());
+      Runtime->setTargetTriple(M.getTargetTriple());
+      if (Linker::linkModules(M, std::move(Runtime)))
+        report_fatal_error("cannot link -softbound-runtime-bc file");
+      // 링크 전에 linkonce로 바꾸면 아직 참조가 없는 함수가 링크되지 않으므로 링크 후에 바꾼다
+      for (Function &F : M)
+      {
+        if (F.hasFnAttribute(RuntimeFnAttr) && F.hasExternalLinkage())
+          F.setLinkage(GlobalValue::LinkOnceODRLinkage);
+      }
+    }
+
+    // 초기값 C(global 안의 offset Offset)에 들어 있는 포인터마다 {slot 주소, base, bound}를 모은다
+    void collectGlobalPointers(Constant *Slot, uint64_t Offset, Constant *Init,
+                               SmallVectorImpl<Constant *> &Records, StructType *RecordTy)
+    {
+      if (Init->isNullValue() || isa<UndefValue>(Init))
+        return;
+      Type *Ty = Init->getType();
+      if (isa<PointerType>(Ty))
+      {
+        // 크기를 모르는 대상(extern, interposable 등)은 getAssociatedMetadata와 같은 NULL/무한 bound로 등록한다.
+        // 건너뛰면 load한 포인터가 빈 slot의 {0, 0}을 받아 모든 접근이 위반이 된다.
+        Metadata MD = {MVoidNullPtr, MInfiniteBoundPtr};
+        getConstantMetadata(Init, MD);
+        Constant *Addr = ConstantExpr::getGetElementPtr(Type::getInt8Ty(*C), Slot,
+                                                        ConstantInt::get(MSizetTy, Offset));
+        Records.push_back(ConstantStruct::get(RecordTy, {Addr, cast<Constant>(MD.Base),
+                                                         cast<Constant>(MD.Bound)}));
+        return;
+      }
+      if (auto *STy = dyn_cast<StructType>(Ty))
+      {
+        const StructLayout *SL = DL->getStructLayout(STy);
+        for (unsigned i = 0, e = STy->getNumElements(); i != e; ++i)
+          collectGlobalPointers(Slot, Offset + SL->getElementOffset(i),
+                                Init->getAggregateElement(i), Records, RecordTy);
+        return;
+      }
+      if (auto *ATy = dyn_cast<ArrayType>(Ty))
+      {
+        if (!isTypeWithPointers(ATy->getElementType()))
+          return;
+        uint64_t ElemSize = DL->getTypeAllocSize(ATy->getElementType()).getFixedSize();
+        for (uint64_t i = 0, e = ATy->getNumElements(); i != e; ++i)
+          collectGlobalPointers(Slot, Offset + i * ElemSize, Init->getAggregateElement(i),
+                                Records, RecordTy);
+      }
+    }
+
+    /*
+    포인터를 초기값으로 가진 global(문자열 표, 함수 밖의 int *p = arr 등)의 metadata를
+    __global_init에서 표 하나로 한 번에 등록한다. 표는 상수라 생성자에서 loop 하나만 돈다.
+    */
+    void registerGlobalPointers(Module &M, IRBuilder<> &IRB)
+    {
+      // runtime의 global_pointer { void *slot; void *base; void *bound; }
+      StructType *RecordTy = StructType::get(MVoidPtrTy, MVoidPtrTy, MVoidPtrTy);
+      SmallVector<Constant *, 16> Records;
+      for (GlobalVariable &GV : M.globals())
+      {
+        if (!GV.hasInitializer() || GV.isThreadLocal() || GV.getName().startswith("llvm.") ||
+            !isTypeWithPointers(GV.getValueType()))
+          continue;
+        collectGlobalPointers(ConstantExpr::getPointerCast(&GV, MVoidPtrTy), 0,
+                              GV.getInitializer(), Records, RecordTy);
+      }
+      if (Records.empty())
+        return;
+      auto *TableTy = ArrayType::get(RecordTy, Records.size());
+      auto *Table = new GlobalVariable(M, TableTy, true, GlobalValue::PrivateLinkage,
+                                       ConstantArray::get(TableTy, Records), "sb.global_pointers");
+      FunctionCallee RegisterGlobals = M.getOrInsertFunction(
+          "__softbound_register_globals",
+          FunctionType::get(Type::getVoidTy(*C), {MVoidPtrTy, MSizetTy}, false));
+      IRB.CreateCall(RegisterGlobals, {IRB.CreateBitCast(Table, MVoidPtrTy),
+                                       ConstantInt::get(MSizetTy, Records.size())});
+    }
+
+    // 외부에서 호출될 수 없는(internal 이고 주소가 노출되지 않은) 함수는 포인터 인자마다
+    // base/bound 인자를 덧붙인 복제본으로 바꿔 shadow stack을 거치지 않고 register로 전달한다.
+    // 포인터를 반환하는 함수는 반환 metadata 때문에 shadow stack을 그대로 사용한다.
+    bool isCloneCandidate(Function &F)
+    {
+      if (F.isDeclaration() || F.hasFnAttribute(RuntimeFnAttr) ||
+          !F.hasLocalLinkage() || F.hasAddressTaken() ||
+          F.isVarArg() || isa<PointerType>(F.getReturnType()))
+        return false;
+      // rewriteClonedCall은 CallInst만 바꾸므로 invoke 등 다른 사용처가 있으면 복제하지 않는다
+      for (Use &U : F.uses())
+      {
+        auto *CI = dyn_cast<CallInst>(U.getUser());
+        if (!CI || !CI->isCallee(&U) || CI->getFunctionType() != F.getFunctionType())
+          return false;
+      }
+      for (Argument &Arg : F.args())
+      {
+        if (isa<PointerType>(Arg.getType()))
+          return true;
+      }
+      return false;
+    }
+
+    void cloneInternalFunctions(Module &M)
+    {
+      SmallVector<Function *, 8> Candidates;
+      for (Function &F : M)
+      {
+        if (isCloneCandidate(F))
+          Candidates.push_back(&F);
+      }
+
+      for (Function *F : Candidates)
+      {
+        SmallVector<Type *, 8> Params(F->getFunctionType()->param_begin(),
+                                      F->getFunctionType()->param_end());
+        for (Argument &Arg : F->args())
+        {
+          if (!isa<PointerType>(Arg.getType()))
+            continue;
+          Params.push_back(MVoidPtrTy);
+          Params.push_back(MVoidPtrTy);
+          if (ClTemporal)
+          {
+            Params.push_back(MSizetTy);
+            Params.push_back(MSizetTy);
+          }
+        }
+        FunctionType *NewTy = FunctionType::get(F->getReturnType(), Params, false);
+        Function *NewF = Function::Create(NewTy, F->getLinkage(), F->getAddressSpace());
+        M.getFunctionList().insert(F->getIterator(), NewF);
+        NewF->copyAttributesFrom(F);
+        NewF->copyMetadata(F, 0);
+        F->clearMetadata();
+        NewF->takeName(F);
+
+        // 본문을 옮기고 원래 인자의 사용처를 새 인자로 바꾼다
+        NewF->getBasicBlockList().splice(NewF->begin(), F->getBasicBlockList());
+        auto NewArg = NewF->arg_begin();
+        for (Argument &Arg : F->args())
+        {
+          NewArg->takeName(&Arg);
+          Arg.replaceAllUsesWith(&*NewArg);
+          ++NewArg;
+        }
+        for (Argument &Arg : F->args())
+        {
+          if (!isa<PointerType>(Arg.getType()))
+            continue;
+          (NewArg++)->setName(NewF->getArg(Arg.getArgNo())->getName() + ".base");
+          (NewArg++)->setName(NewF->getArg(Arg.getArgNo())->getName() + ".bound");
+          if (ClTemporal)
+          {
+            (NewArg++)->setName(NewF->getArg(Arg.getArgNo())->getName() + ".key");
+            (NewArg++)->setName(NewF->getArg(Arg.getArgNo())->getName() + ".lock");
+          }
+        }
+
+        ClonedFunctions[F] = NewF;
+        CloneOrigArgCount[NewF] = F->arg_size();
+      }
     }
 
     static void appendToGlobalArray(const char *Array, Module &M, Function *F,
@@ -383,11 +1840,80 @@ namespace
       appendToGlobalArray("llvm.global_ctors", M, F, Priority, Data);
     }
 
-    PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM)
+    // lock-and-key 시간 검사용 runtime 선언. lock pool은 검사에서 직접 읽는다
+    void setupTemporal(Module &M)
+    {
+      Type *VoidTy = Type::getVoidTy(M.getContext());
+      MPermanentKey = ConstantInt::get(MSizetTy, PermanentKey);
+      MPermanentLock = ConstantInt::get(MSizetTy, PermanentLock);
+      // struct temporal_id { size_t key; size_t lock; }
+      MTemporalIdTy = StructType::get(MSizetTy, MSizetTy);
+      LockPool = ConstantExpr::getPointerCast(
+          M.getOrInsertGlobal("__softbound_locks", ArrayType::get(MSizetTy, 0)),
+          PointerType::getUnqual(MSizetTy));
+
+      setMetaDataTemporal = M.getOrInsertFunction(
+          "set_metadata_temporal",
+          FunctionType::get(VoidTy, {MVoidPtrTy, MVoidPtrTy, MVoidPtrTy, MSizetTy, MSizetTy},
+                            false)); // 인자: (void* ptr, void* base, void* bound, size_t key, size_t lock)
+      getTemporalId = M.getOrInsertFunction(
+          "get_temporal_id", FunctionType::get(MTemporalIdTy, {MVoidPtrTy}, false));
+      boundCheckTemporal = M.getOrInsertFunction(
+          "bound_check_temporal",
+          FunctionType::get(VoidTy,
+                            {MVoidPtrTy, MVoidPtrTy, MVoidPtrTy, MSizetTy, MSizetTy, MSizetTy},
+                            false)); // 인자: (base, bound, access, size, key, lock)
+      reportViolationTemporal = M.getOrInsertFunction(
+          "report_violation_temporal",
+          FunctionType::get(VoidTy,
+                            {MVoidPtrTy, MVoidPtrTy, MVoidPtrTy, MSizetTy, MSizetTy, MSizetTy},
+                            false));
+      if (Function *ReportFn = dyn_cast<Function>(reportViolationTemporal.getCallee()))
+      {
+        ReportFn->addFnAttr(Attribute::Cold);
+        ReportFn->addFnAttr(Attribute::NoInline);
+      }
+      lockAcquire = M.getOrInsertFunction(
+          "__softbound_lock_acquire", FunctionType::get(MTemporalIdTy, {MVoidPtrTy}, false));
+      softboundFreeTemporal = M.getOrInsertFunction(
+          "softbound_free_temporal",
+          FunctionType::get(VoidTy, {MVoidPtrTy, MSizetTy, MSizetTy}, false));
+      softboundReallocTemporal = M.getOrInsertFunction(
+          "softbound_realloc_temporal",
+          FunctionType::get(MVoidPtrTy, {MVoidPtrTy, MSizetTy, MSizetTy, MSizetTy}, false));
+      shadowStackStoreId = M.getOrInsertFunction(
+          "shadow_stack_store_id",
+          FunctionType::get(VoidTy, {MSizetTy, MSizetTy, MSizetTy}, false)); // 인자: (index, key, lock)
+      shadowStackStoreReturnId = M.getOrInsertFunction(
+          "shadow_stack_store_return_id",
+          FunctionType::get(VoidTy, {MVoidPtrTy, MSizetTy, MSizetTy}, false)); // 인자: (callee, key, lock)
+      shadowStackLoadKey = M.getOrInsertFunction(
+          "shadow_stack_load_key", FunctionType::get(MSizetTy, {MSizetTy, MVoidPtrTy}, false));
+      shadowStackLoadLock = M.getOrInsertFunction(
+          "shadow_stack_load_lock", FunctionType::get(MSizetTy, {MSizetTy, MVoidPtrTy}, false));
+
+      for (FunctionCallee FC :
+           {setMetaDataTemporal, getTemporalId, boundCheckTemporal, reportViolationTemporal,
+            lockAcquire, shadowStackStoreId, shadowStackStoreReturnId, shadowStackLoadKey,
+            shadowStackLoadLock})
+        InstrumentationCallees.insert(FC.getCallee()->stripPointerCasts());
+    }
+
+    // 모듈 단위 준비: runtime 선언, __global_init 생성자, 내부 함수 복제
+    void setupModule(Module &M)
     {
+      if (ClSlotBytes != 8 && ClSlotBytes != 16)
+        report_fatal_error("-softbound-slot-bytes must be 8 or 16");
+      // 값에서 계산한 bound에는 key/lock이 없다
+      if (ClLowFat && ClTemporal)
+        report_fatal_error("-softbound-lowfat cannot be combined with -softbound-temporal");
+      if (!ClRuntimeBitcode.empty())
+        linkRuntimeBitcode(M);
+      if (!ClProfile.empty())
+        loadProfile();
       MVoidPtrTy = PointerType::getInt8PtrTy(M.getContext());
       MVoidNullPtr = ConstantPointerNull::get(MVoidPtrTy);
-      size_t InfBound;
+      size_t InfBound = ~(size_t)0;
       MSizetTy = Type::getInt64Ty(M.getContext());
       
       Constant *InfiniteBound = ConstantInt::get(MSizetTy, InfBound, false);
@@ -414,7 +1940,8 @@ namespace
           "bound_check",
           FunctionType::get(
               Type::getVoidTy(M.getContext()),                                          // 반환 타입: void
-              {Type::getInt8PtrTy(M.getContext()), Type::getInt8PtrTy(M.getContext()),Type::getInt8PtrTy(M.getContext())}, // 인자: (void* ptr, void* ptr)
+              {Type::getInt8PtrTy(M.getContext()), Type::getInt8PtrTy(M.getContext()),
+               Type::getInt8PtrTy(M.getContext()), MSizetTy}, // 인자: (void* base, void* bound, void* access, size_t size)
               false                                                                     // 가변 인자 여부: false
               ));
 
@@ -437,6 +1964,103 @@ namespace
               Type::getInt8PtrTy(M.getContext()),
               {Type::getInt8PtrTy(M.getContext())},
               false));
+      // 위반 시에만 도달하는 cold path
+      reportViolation = M.getOrInsertFunction(
+          "report_violation",
+          FunctionType::get(
+              Type::getVoidTy(M.getContext()),
+              {Type::getInt8PtrTy(M.getContext()), Type::getInt8PtrTy(M.getContext()),
+               Type::getInt8PtrTy(M.getContext()), MSizetTy}, // 인자: (void* base, void* bound, void* access, size_t size)
+              false));
+      if (Function *ReportFn = dyn_cast<Function>(reportViolation.getCallee()))
+      {
+        ReportFn->addFnAttr(Attribute::Cold);
+        ReportFn->addFnAttr(Attribute::NoInline);
+      }
+      // shadow stack: 함수 경계에서 포인터 인자/반환값의 metadata 전달
+      shadowStackAllocate = M.getOrInsertFunction(
+          "shadow_stack_allocate",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MSizetTy, MVoidPtrTy}, // 인자: (size_t nargs, void* callee)
+                            false));
+      shadowStackDeallocate = M.getOrInsertFunction(
+          "shadow_stack_deallocate",
+          FunctionType::get(Type::getVoidTy(M.getContext()), false));
+      shadowStackStore = M.getOrInsertFunction(
+          "shadow_stack_store",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MSizetTy, MVoidPtrTy, MVoidPtrTy}, // 인자: (size_t index, void* base, void* bound)
+                            false));
+      shadowStackStoreReturn = M.getOrInsertFunction(
+          "shadow_stack_store_return",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MVoidPtrTy, MVoidPtrTy, MVoidPtrTy}, // 인자: (void* callee, void* base, void* bound)
+                            false));
+      shadowStackLoadBase = M.getOrInsertFunction(
+          "shadow_stack_load_base",
+          FunctionType::get(MVoidPtrTy, {MSizetTy, MVoidPtrTy}, false));
+      shadowStackLoadBound = M.getOrInsertFunction(
+          "shadow_stack_load_bound",
+          FunctionType::get(MVoidPtrTy, {MSizetTy, MVoidPtrTy}, false));
+      // 구간 단위 metadata 복사/이동/삭제
+      metadataCopy = M.getOrInsertFunction(
+          "metadata_copy",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MVoidPtrTy, MVoidPtrTy, MSizetTy}, // 인자: (void* dst, void* src, size_t size)
+                            false));
+      metadataMove = M.getOrInsertFunction(
+          "metadata_move",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MVoidPtrTy, MVoidPtrTy, MSizetTy}, false));
+      metadataClear = M.getOrInsertFunction(
+          "metadata_clear",
+          FunctionType::get(Type::getVoidTy(M.getContext()),
+                            {MVoidPtrTy, MSizetTy}, // 인자: (void* ptr, size_t size)
+                            false));
+      // realloc/free/munmap 대체: 블록 안에 저장된 포인터의 metadata 이동/삭제
+      softboundRealloc = M.getOrInsertFunction(
+          "softbound_realloc",
+          FunctionType::get(MVoidPtrTy, {MVoidPtrTy, MSizetTy}, false));
+      softboundFree = M.getOrInsertFunction(
+          "softbound_free",
+          FunctionType::get(Type::getVoidTy(M.getContext()), {MVoidPtrTy}, false));
+      softboundMunmap = M.getOrInsertFunction(
+          "softbound_munmap",
+          FunctionType::get(Type::getInt32Ty(M.getContext()), {MVoidPtrTy, MSizetTy}, false));
+      // 포인터 load 시 base/bound를 한 번에 반환: struct { void *base; void *bound; }
+      // trie entry는 시간 검사 모드에서 뒤에 key/lock이 붙는다
+      MBoundsTy = StructType::get(MVoidPtrTy, MVoidPtrTy);
+      MMetadataTy = ClTemporal ? StructType::get(MVoidPtrTy, MVoidPtrTy, MSizetTy, MSizetTy)
+                               : MBoundsTy;
+      getMetadata = M.getOrInsertFunction(
+          "get_metadata",
+          FunctionType::get(MBoundsTy, {MVoidPtrTy}, false));
+      // runtime이 링크된 경우 %struct.Metadata 타입의 정의가 있으므로 bitcast가 반환될 수 있다
+      PrimaryTable = M.getOrInsertGlobal(
+          "primary_table", PointerType::getUnqual(PointerType::getUnqual(MMetadataTy)));
+      NullMetadata = new GlobalVariable(M, MMetadataTy, true, GlobalValue::PrivateLinkage,
+                                        Constant::getNullValue(MMetadataTy),
+                                        "sb.null_metadata");
+      NullMetadata->setAlignment(Align(16));
+      for (FunctionCallee FC :
+           {setMetaData, printMetadata, boundCheck, reportViolation, shadowStackAllocate,
+            shadowStackDeallocate, shadowStackStore, shadowStackStoreReturn, shadowStackLoadBase,
+            shadowStackLoadBound, metadataCopy, metadataMove, metadataClear, getMetadata})
+        InstrumentationCallees.insert(FC.getCallee()->stripPointerCasts());
+      if (ClTemporal)
+        setupTemporal(M);
+      if (ClLowFat)
+      {
+        LowFatClasses = M.getOrInsertGlobal("__softbound_lowfat_classes", MSizetTy);
+        lowfatMalloc = M.getOrInsertFunction("softbound_lowfat_malloc",
+                                             FunctionType::get(MVoidPtrTy, {MSizetTy}, false));
+        lowfatCalloc = M.getOrInsertFunction(
+            "softbound_lowfat_calloc", FunctionType::get(MVoidPtrTy, {MSizetTy, MSizetTy}, false));
+        getMetadataLowFat = M.getOrInsertFunction(
+            "get_metadata_lowfat",
+            FunctionType::get(MBoundsTy, {MVoidPtrTy, MVoidPtrTy}, false)); // 인자: (void* access, void* ptr)
+        InstrumentationCallees.insert(getMetadataLowFat.getCallee()->stripPointerCasts());
+      }
       initTable = M.getOrInsertFunction(
           "_init_metadata_table",
           FunctionType::get(
@@ -449,6 +2073,9 @@ namespace
       Function *CtorFunc = Function::Create(
           FunctionType::get(Type::getVoidTy(M.getContext()), false), // 함수 타입: void()
           GlobalValue::InternalLinkage, "__global_init", &M);        // 함수 이름 및 링키지
+      GlobalInit = CtorFunc;
+      // runtime 초기화 코드이므로 계측하지 않는다
+      CtorFunc->addFnAttr(RuntimeFnAttr);
 
       // 기본 블록 생성
       BasicBlock *BB = BasicBlock::Create(M.getContext(), "entry", CtorFunc);
@@ -458,54 +2085,185 @@ namespace
 
       // _init_metadata_table 호출 삽입
       IRB.CreateCall(initTable);
+      registerGlobalPointers(M, IRB);
       // 함수 종료 코드 추가
       IRB.CreateRetVoid();
 
       // __global_init을 전역 생성자에 등록
       appendToGlobalCtors(M, CtorFunc, 0, nullptr);
-      for (Function &F : M)
+      if (ClCloneInternalFunctions)
+        cloneInternalFunctions(M);
+      if (ClSiteCounters)
+        SiteCounters = new GlobalVariable(M, ArrayType::get(MSizetTy, 0), false,
+                                          GlobalValue::PrivateLinkage, nullptr,
+                                          "sb.site_counters.placeholder");
+    }
+
+    bool shouldInstrument(Function &F)
+    {
+      return !F.isDeclaration() && !F.hasFnAttribute(RuntimeFnAttr);
+    }
+
+    /*
+    함수 하나의 계측. function pass adaptor 아래에서 함수마다 차례로(직렬로) 불린다.
+    함수별 상태는 여기서 만드는 FunctionContext에 두지만, 통계와 SiteKeys, 복제본 호출 변경,
+    SiteCounters와 상수 식(LLVMContext 공유) 등 모듈 상태도 고치므로 여러 함수를 동시에 돌릴 수는 없다.
+    */
+    void instrumentFunction(Function &F, FunctionAnalysisManager &FAM)
+    {
+      FunctionContext FC;
+      // inline check가 블록을 나누므로 순회 전에 원본 명령어를 먼저 모아둔다
+      SmallVector<Instruction *, 64> Worklist;
+      for (BasicBlock &BB : F)
+        for (Instruction &I : BB)
+          Worklist.push_back(&I);
+
+      handle_prologue(FC, F);
+
+      for (Instruction *Inst : Worklist)
       {
-        for (BasicBlock &BB : F)
+        Instruction &I = *Inst;
+        // errs() << "handling instruction : " << I << "\n";
+        switch (I.getOpcode())
+        {
+        case Instruction::Alloca:
+        {
+          handle_alloca(FC, I);
+          break;
+        }
+        case Instruction::GetElementPtr:
+        {
+          handle_GEP(FC, I);
+          break;
+        }
+        case Instruction::Load:
+        {
+          handle_load(FC, I);
+          break;
+        }
+        case Instruction::Store:
         {
+          handle_store(FC, I);
+          break;
+        }
+        case Instruction::BitCast:
+          handle_bitcast(FC, I);
+          break;
+        case Instruction::PHI:
+          handle_phi(FC, I);
+          break;
+        case Instruction::Select:
+          handle_select(FC, I);
+          break;
+        case Instruction::Call:
+          handle_call(FC, I);
+          break;
+        case Instruction::Ret:
+          handle_ret(FC, I);
+          break;
+        }
+      }
+
+      completeShadowPHIs(FC);
+      if (ClTemporal)
+      {
+        for (BasicBlock &BB : F)
           for (Instruction &I : BB)
-          {
-            IRBuilder<> IRB(&I);
-            // errs() << "handling instruction : " << I << "\n";
-            switch (I.getOpcode())
-            {
-            case Instruction::Alloca:
-            {
-              handle_alloca(I);
-              break;
-            }
-            case Instruction::GetElementPtr:
-            {
-              handle_GEP(I);
-              break;
-            }
-            case Instruction::Load:
-            {
-              handle_load(I);
-              break;
-            }
-            case Instruction::Store:
-            {
-              handle_store(I);
-              break;
-            }
-            case Instruction::BitCast:
-              handle_bitcast(I);
-              break;
-            case Instruction::Call:
-              handle_call(I);
-              break;
-            }
-          }
+            FC.FunctionMayFree |= mayFree(I);
+      }
+      if (ClFoldStaticChecks)
+        foldStaticChecks(FC);
+      // 남은 검사가 없으면 DT/LoopInfo/SCEV를 만들 필요가 없다
+      if (!FC.PendingChecks.empty())
+      {
+        DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+        if (ClElimRedundantChecks)
+          eliminateRedundantChecks(FC, DT);
+        if (ClSiteCounters)
+          instrumentSiteCounters(FC);
+        if (!ProfileCounts.empty())
+          applyProfile(FC);
+        if (ClHoistLoopChecks || !ProfileCounts.empty())
+        {
+          LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+          if (!LI.empty())
+            hoistLoopChecks(FC, LI, FAM.getResult<ScalarEvolutionAnalysis>(F), DT);
         }
       }
-      return PreservedAnalyses::none();
+      emitPendingChecks(FC);
+    }
+
+    // 모듈 단위 마무리: 복제된 원본 제거, site counter 표 등록, 통계 출력
+    void finalizeModule(Module &M)
+    {
+      // 호출이 모두 복제본으로 바뀌었으므로 원본은 제거한다
+      for (auto &Clone : ClonedFunctions)
+      {
+        if (Clone.first->use_empty())
+          Clone.first->eraseFromParent();
+      }
+      ClonedFunctions.clear();
+      CloneOrigArgCount.clear();
+      finalizeSiteCounters(M);
+
+      if (ClCheckStats)
+      {
+        errs() << "softbound: " << NumEmittedChecks << " checks emitted, "
+               << NumRedundantChecks << " redundant checks removed, "
+               << NumHoistedChecks << " loop checks hoisted, "
+               << NumStaticSafeChecks << " statically safe, "
+               << NumStaticViolations << " statically out of bounds\n";
+        if (ClTemporal)
+          errs() << "softbound: " << NumTemporalChecks << " checks with a temporal key\n";
+        if (!ClProfile.empty())
+          errs() << "softbound: profile placement: " << NumPlacedSites[PlaceHot] << " hot, "
+                 << NumPlacedSites[PlaceWarm] << " warm, " << NumPlacedSites[PlaceCold]
+                 << " cold, " << NumPlacedSites[PlaceDefault] << " not in profile\n";
+      }
     };
   };
+
+  /*
+  pipeline "softbound" = 모듈 준비 -> 함수 단위 계측(function pass adaptor) -> 모듈 마무리
+  세 pass가 같은 SoftBoundPass 상태(선언, 복제 표, profile, 통계)를 공유한다.
+  */
+  struct SoftBoundModuleSetupPass : public PassInfoMixin<SoftBoundModuleSetupPass>
+  {
+    std::shared_ptr<SoftBoundPass> SB;
+    explicit SoftBoundModuleSetupPass(std::shared_ptr<SoftBoundPass> SB) : SB(std::move(SB)) {}
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+      SB->setupModule(M);
+      return PreservedAnalyses::none();
+    }
+    static bool isRequired() { return true; }
+  };
+
+  struct SoftBoundFunctionPass : public PassInfoMixin<SoftBoundFunctionPass>
+  {
+    std::shared_ptr<SoftBoundPass> SB;
+    explicit SoftBoundFunctionPass(std::shared_ptr<SoftBoundPass> SB) : SB(std::move(SB)) {}
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM)
+    {
+      if (!SB->shouldInstrument(F))
+        return PreservedAnalyses::all();
+      SB->instrumentFunction(F, FAM);
+      return PreservedAnalyses::none();
+    }
+    static bool isRequired() { return true; }
+  };
+
+  struct SoftBoundModuleFinalizePass : public PassInfoMixin<SoftBoundModuleFinalizePass>
+  {
+    std::shared_ptr<SoftBoundPass> SB;
+    explicit SoftBoundModuleFinalizePass(std::shared_ptr<SoftBoundPass> SB) : SB(std::move(SB)) {}
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+      SB->finalizeModule(M);
+      return PreservedAnalyses::none();
+    }
+    static bool isRequired() { return true; }
+  };
 }
 
 llvm::PassPluginLibraryInfo
@@ -520,7 +2278,16 @@ getSoftBoundPassPluginInfo()
                 {
                   if (Name == "softbound")
                   {
-                    MPM.addPass(SoftBoundPass());
+                    auto SB = std::make_shared<SoftBoundPass>();
+                    MPM.addPass(SoftBoundModuleSetupPass(SB));
+                    MPM.addPass(createModuleToFunctionPassAdaptor(SoftBoundFunctionPass(SB)));
+                    MPM.addPass(SoftBoundModuleFinalizePass(SB));
+                    // 링크된 runtime의 always_inline 함수를 검사 위치에 펼치고 남은 사본은 제거
+                    if (!ClRuntimeBitcode.empty())
+                    {
+                      MPM.addPass(AlwaysInlinerPass());
+                      MPM.addPass(GlobalDCEPass());
+                    }
                     return true;
                   }
                   return false;
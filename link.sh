@@ -1,3 +1,4 @@
-gcc -shared -fPIC softbound.c -o libsoftbound.so
+gcc -shared -fPIC -mcx16 softbound.c -o libsoftbound.so
 clang output.ll -o output_binary -L. -lsoftbound -lm -Wl,-rpath, .
 # link 할 때 라이브러리를 못찾아서 추가해줌
+# 추적 출력이 필요하면 runtime을 -DSOFTBOUND_TRACE=1 로 빌드하고 pass에 -softbound-trace를 준다
@@ -2,4 +2,6 @@ cd build
 cmake ..
 make
 cd ..
-opt -load-pass-plugin ./build/libSoftBoundPass.so --passes=softbound -o output.ll test.ll 
+# -load는 softbound-* 옵션(cl::opt)을 opt가 인식하도록 하기 위해 필요
+# runtime inline: SOFTBOUND_FLAGS=-softbound-runtime-bc=./build/softbound.bc (clang이 있을 때 빌드됨)
+opt -load ./build/libSoftBoundPass.so -load-pass-plugin ./build/libSoftBoundPass.so --passes=softbound $SOFTBOUND_FLAGS -o output.ll test.ll 
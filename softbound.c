@@ -5,8 +5,20 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/uio.h>
 #include <sys/mman.h>
 #include <bits/mman-linux.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
 
 
 #define RED "\033[1;31m"
@@ -23,65 +35,493 @@ primary table: 대략적인 메모리 영역을 구분
 secondary table: primary table내 세부 위치 구분
 */
 
-// #define HASH_TABLE_SIZE (1 << 20) // 2^20
-#define PRIMARY_TABLE_SIZE (1 << 25) // 48-25
-#define SECONDARY_TABLE_SIZE (1 << 20)
-static const size_t __SOFTBOUNDCETS_TRIE_SECONDARY_TABLE_ENTRIES =
-    ((size_t)4 * (size_t)1024 * (size_t)1024);
+/*
+주소 분할 (48비트 사용자 주소 공간 기준, SLOT_SHIFT = log2(slot 크기))
+  [47 ........ SLOT_SHIFT+SECONDARY_BITS | ... SLOT_SHIFT | SLOT_SHIFT-1 .. 0]
+        primary index                      secondary index     slot 내부 offset
+primary/secondary index 비트가 겹치거나 빠지는 비트가 없어야 서로 다른 포인터 slot이
+같은 Metadata를 공유하지 않는다.
+SOFTBOUND_SLOT_BYTES=8 이면 포인터 하나당 slot 하나, 16이면 테이블 크기가 절반이 되는 대신
+인접한 두 포인터가 slot을 공유한다.
+pass가 trie 탐색을 IR로 inline 하므로 pass의 -softbound-slot-bytes도 같은 값이어야 한다.
+*/
+#ifndef SOFTBOUND_SLOT_BYTES
+#define SOFTBOUND_SLOT_BYTES 8
+#endif
+#if SOFTBOUND_SLOT_BYTES == 8
+#define SLOT_SHIFT 3
+#elif SOFTBOUND_SLOT_BYTES == 16
+#define SLOT_SHIFT 4
+#else
+#error "SOFTBOUND_SLOT_BYTES must be 8 or 16"
+#endif
+
+#define ADDRESS_BITS 48
+#define SECONDARY_BITS 22
+#define PRIMARY_BITS (ADDRESS_BITS - SECONDARY_BITS - SLOT_SHIFT)
+#define PRIMARY_TABLE_ENTRIES ((size_t)1 << PRIMARY_BITS)
+#define SECONDARY_TABLE_ENTRIES ((size_t)1 << SECONDARY_BITS)
+
+/*
+SOFTBOUND_TEMPORAL=1: CETS 방식 key/lock으로 해제된 메모리 접근(use-after-free, double free)도 검사한다.
+Metadata에 {key, lock}이 붙어 32바이트가 되므로 pass도 -softbound-temporal로 계측해야 한다
+(SOFTBOUND_SLOT_BYTES와 -softbound-slot-bytes처럼 둘이 맞아야 한다).
+*/
+#ifndef SOFTBOUND_TEMPORAL
+#define SOFTBOUND_TEMPORAL 0
+#endif
+
+/*
+CMake의 softbound_runtime_bc target은 clang -O2 -emit-llvm -DSOFTBOUND_BITCODE로 이 파일을 bitcode로 만들고,
+pass의 -softbound-runtime-bc 옵션이 이를 계측 전에 모듈에 링크한다.
+SOFTBOUND_HOT 함수는 검사/metadata 접근마다 호출되므로 그 경우 호출 위치에 always_inline 된다.
+여러 모듈에 복사되는 함수와 달리 변경 가능한 전역은 공유 라이브러리의 정의 하나만 쓰이므로
+static 전역을 두지 않는다(pass가 static 전역이 있으면 링크를 거부한다).
+*/
+#ifdef SOFTBOUND_BITCODE
+#define SOFTBOUND_HOT __attribute__((always_inline))
+#else
+#define SOFTBOUND_HOT
+#endif
+
+/*
+SOFTBOUND_TRACE=1: metadata 저장/초기화 과정을 stdout으로 출력하고 위반 시 memory dump를 남긴다(디버깅용).
+SOFTBOUND_TRACE=0(기본): hot path에서 출력하지 않고 위반만 sb_report로 stderr에 보고한다.
+pass의 -softbound-trace도 함께 켜야 load마다 print_metadata 호출이 삽입된다.
+*/
+#ifndef SOFTBOUND_TRACE
+#define SOFTBOUND_TRACE 0
+#endif
+#if SOFTBOUND_TRACE
+#define SB_TRACE(...) printf(__VA_ARGS__)
+#else
+#define SB_TRACE(...) ((void)0)
+#endif
+
+/*
+위반 보고용 출력: stdio lock/malloc 없이 stack buffer에 메시지를 만들고 write(2) 한 번으로 내보낸다.
+signal handler나 malloc 내부 상태가 깨진 뒤에도 안전하게 쓸 수 있다.
+*/
+typedef struct
+{
+  char buf[512];
+  size_t len;
+} sb_report;
+
+static void sb_report_str(sb_report *r, const char *str)
+{
+  while (*str && r->len < sizeof(r->buf))
+    r->buf[r->len++] = *str++;
+}
+
+static void sb_report_num(sb_report *r, uintptr_t value, unsigned radix)
+{
+  // 10진수가 가장 길다: 64비트 값은 최대 20자리
+  char digits[3 * sizeof(uintptr_t) + 1];
+  size_t n = 0;
+  do
+  {
+    digits[n++] = "0123456789abcdef"[value % radix];
+    value /= radix;
+  } while (value != 0);
+  if (radix == 16)
+    sb_report_str(r, "0x");
+  while (n > 0 && r->len < sizeof(r->buf))
+    r->buf[r->len++] = digits[--n];
+}
+
+static void sb_report_flush(sb_report *r)
+{
+  size_t done = 0;
+  while (done < r->len)
+  {
+    ssize_t written = write(STDERR_FILENO, r->buf + done, r->len - done);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      break;
+    done += written;
+  }
+  r->len = 0;
+}
 
+// 복구할 수 없는 runtime 오류
+__attribute__((noreturn, cold))
+static void sb_fatal(const char *message)
+{
+  sb_report r = {.len = 0};
+  sb_report_str(&r, "softbound: ");
+  sb_report_str(&r, message);
+  sb_report_str(&r, "\n");
+  sb_report_flush(&r);
+  abort();
+}
+
+typedef struct
+{
+  void *base;
+  void *bound;
+#if SOFTBOUND_TEMPORAL
+  size_t key;
+  size_t lock;
+#endif
+} __attribute__((aligned(16))) Metadata;
 
+// get_metadata 반환값. 16바이트 struct라 x86-64에서 rax/rdx로 돌아온다
 typedef struct
 {
   void *base;
   void *bound;
-} Metadata;
+} metadata_bounds;
+
+/*
+멀티스레드 지원
+- secondary table 설치는 CAS로 한 스레드만 성공하고, 진 스레드는 자기 테이블을 해제한다.
+- base/bound 쌍은 16바이트 단위로 원자적으로 읽고 써서 다른 스레드가 반쯤 갱신된 값을 보지 않는다.
+  AVX CPU에서는 정렬된 16바이트 load/store가 원자적이므로(Intel/AMD 모두 보장) 그대로 쓰고,
+  그 외에는 cmpxchg16b(-mcx16 필요)로 읽고 쓴다.
+*/
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+#error "softbound.c needs 16-byte compare-and-swap; build with -mcx16"
+#endif
+
+typedef unsigned __int128 metadata_word;
+
+// Metadata 하나를 이루는 16바이트 word 수. {base, bound}와 {key, lock}이 각각 한 word다
+#define METADATA_WORDS (sizeof(Metadata) / sizeof(metadata_word))
+
+static inline metadata_word metadata_pack(void *base, void *bound)
+{
+  return (metadata_word)(uintptr_t)base | ((metadata_word)(uintptr_t)bound << 64);
+}
+
+static inline metadata_word metadata_word_load(metadata_word *word)
+{
+#ifdef __AVX__
+  metadata_word result;
+  __m128i v = _mm_load_si128((__m128i *)word);
+  __builtin_memcpy(&result, &v, sizeof(result));
+  return result;
+#else
+  return __sync_val_compare_and_swap(word, 0, 0);
+#endif
+}
+
+static inline void metadata_word_store(metadata_word *word, metadata_word desired)
+{
+#ifdef __AVX__
+  __m128i v;
+  __builtin_memcpy(&v, &desired, sizeof(v));
+  _mm_store_si128((__m128i *)word, v);
+#else
+  metadata_word expected = *word;
+  metadata_word seen;
+  while ((seen = __sync_val_compare_and_swap(word, expected, desired)) != expected)
+    expected = seen;
+#endif
+}
+
+static inline metadata_bounds metadata_load(Metadata *entry)
+{
+  metadata_word word = metadata_word_load((metadata_word *)entry);
+  metadata_bounds result = {(void *)(uintptr_t)word, (void *)(uintptr_t)(word >> 64)};
+  return result;
+}
+
+static inline void metadata_store(Metadata *entry, void *base, void *bound)
+{
+  metadata_word_store((metadata_word *)entry, metadata_pack(base, bound));
+}
 
-// Metadata metadata_table[HASH_TABLE_SIZE];
-// Metadata *metadata_table = NULL;
 Metadata **primary_table = NULL;
 
+#if SOFTBOUND_TEMPORAL
+/*
+시간적 안전성 (CETS key/lock)
+- heap 할당마다 한 번도 쓰지 않은 key와 lock pool의 slot 하나를 받고, lock slot에 key를 써 둔다.
+  포인터 metadata는 {key, lock index}를 함께 들고 다니며, 접근할 때 __softbound_locks[lock] == key를 확인한다.
+- free는 lock slot을 LOCK_FREE로 바꿔 pool에 돌려준다. 이후 같은 slot을 다른 할당이 받아도 key가 다르므로
+  해제 전에 복사해 둔 포인터는 계속 걸린다. key는 64비트 증가값이라 다시 나오지 않는다.
+- pool은 .bss의 고정 배열이라 할당마다 malloc이 없고, 검사는 전역 배열 load 하나와 비교 하나다.
+- lock 0(LOCK_NONE)은 metadata가 없는 slot의 {0, 0}이고 값도 항상 0이라 시간 검사는 통과한다(공간 검사에서 걸린다).
+  lock 1(LOCK_PERMANENT)은 global/stack/계측 밖에서 온 포인터가 쓰며 해제되지 않는다.
+- 반환된 slot은 자기 안에 LOCK_FREE | 다음 slot을 담는 lock-free stack이다. head는 {slot, tag} 16바이트라
+  cmpxchg16b로 갱신해 ABA를 막는다. pool이 바닥나면 LOCK_PERMANENT를 주고 시간 검사를 포기한다.
+*/
+#define LOCK_POOL_BITS 24
+#define LOCK_POOL_ENTRIES ((size_t)1 << LOCK_POOL_BITS)
+#define LOCK_NONE 0
+#define LOCK_PERMANENT 1
+#define KEY_PERMANENT 1
+#define LOCK_FREE ((size_t)1 << 63)
+
+typedef struct
+{
+  size_t key;
+  size_t lock;
+} temporal_id;
+
+size_t __softbound_locks[LOCK_POOL_ENTRIES];
+metadata_word __softbound_lock_free_list = 0;
+size_t __softbound_lock_bump = LOCK_PERMANENT + 1;
+size_t __softbound_next_key = KEY_PERMANENT + 1;
+size_t __softbound_locks_exhausted = 0;
+#endif
+
+/*
+secondary table 회수
+- primary table과 같은 mapping 뒤쪽에 secondary table마다 occupancy(값이 있는 slot 수)를 둔다.
+- free/realloc/munmap이 영역을 지우면 그만큼 빼고, 0이 되면 table의 page를 MADV_DONTNEED로 돌려준다.
+  lock 없이 table을 읽는 코드(pass가 inline 한 trie 탐색 포함)가 있으므로 unmap하지 않고 주소는 남긴다.
+  돌려준 page는 다시 읽으면 0, 즉 빈 metadata로 보인다.
+- 회수하는 동안 live에 SECONDARY_RECLAIMING을 세워 두고, 그 사이 빈 slot을 채우려는 쪽은 끝날 때까지 기다린다.
+- 회수 후 (SECONDARY_HOT_SLOTS << 회수 횟수)번 이상 채워진 table만 다시 회수한다. 같은 주소를 계속
+  할당/해제하는 loop가 매번 madvise와 page fault를 일으키지 않도록 회수할수록 간격을 늘린다.
+- DISCARD_MIN_BYTES 이상을 지울 때는(큰 free/munmap) 통째로 덮이는 metadata page를 0으로 쓰는 대신 돌려준다.
+  glibc가 mmap으로 주는 128KB 이상 블록에 해당하는 크기라, 금방 재사용될 작은 heap 블록은 page를 유지한다.
+SOFTBOUND_RECLAIM=0: occupancy를 세지 않고 page도 돌려주지 않는다. set/free마다 atomic 연산이 빠지고
+  같은 주소를 다시 쓸 때 page fault가 없으므로 금방 끝나거나 큰 buffer를 계속 바꿔 쓰는 process에 쓴다.
+SOFTBOUND_THP=1: SECONDARY_HOT_SLOTS번 이상 채워진 table에 MADV_HUGEPAGE를 걸어 TLB miss를 줄인다.
+드문드문 쓰이는 table은 4KB page로 남겨 huge page 하나 때문에 RSS가 불어나지 않게 한다.
+*/
+#define SECONDARY_TABLE_BYTES (SECONDARY_TABLE_ENTRIES * sizeof(Metadata))
+#define SECONDARY_RECLAIMING ((size_t)1 << 63)
+#define SECONDARY_HOT_SLOTS ((size_t)1 << 12)
+#define MAX_RECLAIM_BACKOFF 16
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+#define METADATA_PAGE_BYTES ((size_t)4096)
+#define DISCARD_MIN_BYTES ((size_t)256 << 10)
+
+typedef struct
+{
+  size_t live;
+  size_t fills;
+  size_t reclaims;
+} secondary_occupancy;
+
+int __softbound_reclaim = 1;
+int __softbound_thp = 0;
+size_t __softbound_tables_reclaimed = 0;
+
+/*
+위반 위치 주변 memory dump. access 주변 DUMP_LINES줄만 출력하고,
+각 줄은 process_vm_readv로 먼저 복사해 읽을 수 없는 page(unmapped, PROT_NONE)에서는 fault 대신 ??를 출력한다.
+16바이트 줄은 page 경계를 넘지 않으므로 줄 단위로 읽기 가능 여부가 정해진다.
+*/
+#define DUMP_LINES 8
+
+static bool dump_read_line(uintptr_t addr, unsigned char *out)
+{
+  struct iovec local = {out, 16};
+  struct iovec remote = {(void *)addr, 16};
+  return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == 16;
+}
+
 void print_memory_dump(void *access, void *base, void *bound)
 {
-    unsigned char *start = (unsigned char *)base;
-    unsigned char *end = (unsigned char *)bound;
-    unsigned char *access_addr = (unsigned char *)access;
+  uintptr_t start = (uintptr_t)base;
+  uintptr_t end = (uintptr_t)bound;
+  uintptr_t access_addr = (uintptr_t)access;
+  uintptr_t first = (access_addr & ~(uintptr_t)0xF) - 0x10 * (DUMP_LINES / 2);
+  if (first > access_addr) // 주소 0 근처에서 underflow
+    first = 0;
+  sb_report r = {.len = 0};
+
+  sb_report_str(&r, "==================================================================\n");
+  sb_report_flush(&r);
+  for (int line = 0; line < DUMP_LINES; line++)
+  {
+    uintptr_t current_addr = first + 0x10 * line;
+    unsigned char bytes[16];
+    bool readable = dump_read_line(current_addr, bytes);
 
-    printf("==================================================================\n");
+    sb_report_num(&r, current_addr, 16);
+    sb_report_str(&r, ": ");
+    for (int i = 0; i < 16; i++)
+    {
+      uintptr_t byte_addr = current_addr + i;
+      // 범위 내는 초록, 범위 외는 파랑
+      sb_report_str(&r, byte_addr >= start && byte_addr < end ? GREEN : BLUE);
+      if (readable)
+      {
+        r.buf[r.len++] = "0123456789abcdef"[bytes[i] >> 4];
+        r.buf[r.len++] = "0123456789abcdef"[bytes[i] & 0xF];
+      }
+      else
+      {
+        sb_report_str(&r, "??");
+      }
+      sb_report_str(&r, " " RESET);
+    }
+    sb_report_str(&r, "\n");
 
-    for (unsigned char *current_addr = (unsigned char *)((uintptr_t)start & ~0xF);
-         current_addr < end + 0x100;
-         current_addr += 0x10)
+    // `access` 주소에 맞게 `^` 위치 계산
+    if (current_addr <= access_addr && access_addr < current_addr + 0x10)
     {
-        printf("%p: ", current_addr);
+      int column = 16 + 3 * (int)(access_addr - current_addr);
+      for (int i = 0; i < column; i++)
+        sb_report_str(&r, " ");
+      sb_report_str(&r, RED "^" RESET "\n");
+    }
+    sb_report_flush(&r);
+  }
+  sb_report_str(&r, "==================================================================\n");
+  sb_report_flush(&r);
+}
 
-        // 16바이트 데이터 출력
-        for (int i = 0; i < 16; i++)
-        {
-            unsigned char *byte_addr = current_addr + i;
-
-            if (byte_addr >= start && byte_addr < end) // 범위 내
-            {
-                printf(GREEN "%02x " RESET, *byte_addr);
-            }
-            else // 범위 외
-            {
-                printf(BLUE "%02x " RESET, *byte_addr);
-            }
-        }
+/*
+위반 처리 정책 (SOFTBOUND_POLICY 환경 변수, 기본값은 SOFTBOUND_DEFAULT_POLICY)
+  abort: 보고 후 abort()
+  trap : 보고 후 trap 명령으로 즉시 종료 (debugger가 위반 위치에서 멈춘다)
+  log  : 호출 위치마다 처음 한 번만 보고하고 계속 실행, 종료 시 위치별 횟수 요약
+  count: 실행 중에는 출력 없이 세기만 하고 종료 시 요약
+*/
+enum
+{
+  SB_POLICY_ABORT,
+  SB_POLICY_TRAP,
+  SB_POLICY_LOG,
+  SB_POLICY_COUNT,
+};
+#ifndef SOFTBOUND_DEFAULT_POLICY
+#define SOFTBOUND_DEFAULT_POLICY SB_POLICY_LOG
+#endif
 
-        // `access` 주소에 맞게 `^` 위치 계산
-        if (current_addr <= access_addr && access_addr < current_addr + 0x10)
-        {
-            int offset = access_addr - current_addr; // `access`의 위치 계산
-            printf("\n%*s" RED "^" RESET "\n", 16 + (offset * 3), ""); // 동적 위치 계산
-        }
-        else
-        {
-            printf("\n");
-        }
+int __softbound_policy = SOFTBOUND_DEFAULT_POLICY;
+bool __softbound_dump = SOFTBOUND_TRACE; // SOFTBOUND_DUMP=1 로도 켤 수 있다
+
+/*
+호출 위치(return address)별 위반 횟수. lock 없이 CAS로 slot을 차지하는 open addressing 표라
+signal handler 안이나 여러 스레드에서 동시에 위반이 나도 안전하다.
+표가 가득 차면 위치 구분 없이 __softbound_violations_unsited에만 센다.
+*/
+#define VIOLATION_SITE_BITS 10
+#define VIOLATION_SITE_ENTRIES ((size_t)1 << VIOLATION_SITE_BITS)
+// 보고 폭주를 막기 위한 초당 최대 보고 수 (abort/trap은 항상 보고)
+#define VIOLATION_REPORTS_PER_SECOND 16
+
+typedef struct
+{
+  uintptr_t site;
+  size_t hits;
+} violation_site;
+
+violation_site __softbound_violation_sites[VIOLATION_SITE_ENTRIES];
+size_t __softbound_violations_unsited = 0;
+size_t __softbound_reports_suppressed = 0;
+uint64_t __softbound_report_second = 0;
+size_t __softbound_reports_this_second = 0;
+
+static violation_site *violation_site_lookup(uintptr_t site)
+{
+  size_t index = (size_t)((site * 0x9E3779B97F4A7C15ull) >> (64 - VIOLATION_SITE_BITS));
+  for (size_t probe = 0; probe < VIOLATION_SITE_ENTRIES; probe++)
+  {
+    violation_site *entry = &__softbound_violation_sites[(index + probe) & (VIOLATION_SITE_ENTRIES - 1)];
+    uintptr_t seen = __atomic_load_n(&entry->site, __ATOMIC_ACQUIRE);
+    if (seen == 0 &&
+        __atomic_compare_exchange_n(&entry->site, &seen, site, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return entry;
+    // CAS가 실패하면 seen에 먼저 slot을 차지한 위치가 들어 있다
+    if (seen == site)
+      return entry;
+  }
+  return NULL;
+}
+
+// 1초 단위 window마다 VIOLATION_REPORTS_PER_SECOND개까지 보고를 허용한다
+static bool violation_report_allowed()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t second = (uint64_t)now.tv_sec;
+  uint64_t window = __atomic_load_n(&__softbound_report_second, __ATOMIC_RELAXED);
+  if (window != second &&
+      __atomic_compare_exchange_n(&__softbound_report_second, &window, second, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    __atomic_store_n(&__softbound_reports_this_second, 0, __ATOMIC_RELAXED);
+  return __atomic_fetch_add(&__softbound_reports_this_second, 1, __ATOMIC_RELAXED) <
+         VIOLATION_REPORTS_PER_SECOND;
+}
+
+// 종료 시 위치별 위반 횟수 요약 (log/count 정책)
+static void violation_summary()
+{
+  size_t total = __softbound_violations_unsited, sites = 0;
+  for (size_t i = 0; i < VIOLATION_SITE_ENTRIES; i++)
+  {
+    if (__softbound_violation_sites[i].site != 0)
+    {
+      total += __softbound_violation_sites[i].hits;
+      sites++;
     }
+  }
+  if (total == 0)
+    return;
 
-    printf("==================================================================\n");
+  sb_report r = {.len = 0};
+  sb_report_str(&r, "softbound: ");
+  sb_report_num(&r, total, 10);
+#if SOFTBOUND_TEMPORAL
+  sb_report_str(&r, " memory safety violations at ");
+#else
+  sb_report_str(&r, " out-of-bound accesses at ");
+#endif
+  sb_report_num(&r, sites, 10);
+  sb_report_str(&r, " call sites");
+  if (__softbound_reports_suppressed != 0)
+  {
+    sb_report_str(&r, " (");
+    sb_report_num(&r, __softbound_reports_suppressed, 10);
+    sb_report_str(&r, " reports rate-limited)");
+  }
+  sb_report_str(&r, "\n");
+  sb_report_flush(&r);
+  for (size_t i = 0; i < VIOLATION_SITE_ENTRIES; i++)
+  {
+    violation_site *entry = &__softbound_violation_sites[i];
+    if (entry->site == 0)
+      continue;
+    // addr2line에 바로 쓸 수 있도록 모듈 내 offset도 출력
+    Dl_info info;
+    sb_report_str(&r, "softbound:   site ");
+    sb_report_num(&r, entry->site, 16);
+    if (dladdr((void *)entry->site, &info) && info.dli_fname)
+    {
+      sb_report_str(&r, " (");
+      sb_report_str(&r, info.dli_fname);
+      sb_report_str(&r, "+");
+      sb_report_num(&r, entry->site - (uintptr_t)info.dli_fbase, 16);
+      sb_report_str(&r, ")");
+    }
+    sb_report_str(&r, ": ");
+    sb_report_num(&r, entry->hits, 10);
+    sb_report_str(&r, " hits\n");
+    sb_report_flush(&r);
+  }
+}
+
+static void violation_policy_init()
+{
+  const char *policy = getenv("SOFTBOUND_POLICY");
+  if (policy != NULL)
+  {
+    if (strcmp(policy, "abort") == 0)
+      __softbound_policy = SB_POLICY_ABORT;
+    else if (strcmp(policy, "trap") == 0)
+      __softbound_policy = SB_POLICY_TRAP;
+    else if (strcmp(policy, "log") == 0)
+      __softbound_policy = SB_POLICY_LOG;
+    else if (strcmp(policy, "count") == 0)
+      __softbound_policy = SB_POLICY_COUNT;
+    else
+      sb_fatal("SOFTBOUND_POLICY must be abort, trap, log or count");
+  }
+  const char *dump = getenv("SOFTBOUND_DUMP");
+  if (dump != NULL)
+    __softbound_dump = dump[0] == '1';
+  atexit(violation_summary);
 }
 
 
@@ -90,191 +530,1082 @@ void print_memory_dump(void *access, void *base, void *bound)
 
 size_t get_primary_index(void *ptr)
 {
-  return (uintptr_t)ptr >> 25; // 상위 23비트 사용
+  return ((uintptr_t)ptr >> (SLOT_SHIFT + SECONDARY_BITS)) & (PRIMARY_TABLE_ENTRIES - 1);
 }
 
 size_t get_secondary_index(void *ptr)
 {
-  return ((uintptr_t)ptr >> 4) & (SECONDARY_TABLE_SIZE - 1); // 하위 20비트 사용
+  return ((uintptr_t)ptr >> SLOT_SHIFT) & (SECONDARY_TABLE_ENTRIES - 1);
 }
 
+// 각 module의 __global_init ctor가 모두 호출하므로 처음 한 번만 초기화한다.
+// MAP_NORESERVE로 주소 공간만 잡고 page는 건드리지 않는다. 익명 mapping은 이미 0이므로
+// 2차 table 포인터를 NULL로 채울 필요가 없다. 동시에 들어오면 CAS에서 진 쪽이 자기 mapping을 해제한다.
 void _init_metadata_table(){
-  printf("initializing table\n");
-  primary_table = (Metadata **)mmap(NULL, sizeof(Metadata) * PRIMARY_TABLE_SIZE,
-                                      PROT_READ | PROT_WRITE,
-                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if(primary_table == MAP_FAILED){
-    printf("error table\n");
+  if (__atomic_load_n(&primary_table, __ATOMIC_ACQUIRE) != NULL)
+    return;
+  SB_TRACE("initializing table\n");
+  size_t length = (sizeof(Metadata *) + sizeof(secondary_occupancy)) * PRIMARY_TABLE_ENTRIES;
+  Metadata **fresh = (Metadata **)mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (fresh == MAP_FAILED)
+    sb_fatal("primary table mmap failed");
+  Metadata **expected = NULL;
+  if (!__atomic_compare_exchange_n(&primary_table, &expected, fresh, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    munmap(fresh, length);
+    return;
   }
+#if SOFTBOUND_TEMPORAL
+  __atomic_store_n(&__softbound_locks[LOCK_PERMANENT], KEY_PERMANENT, __ATOMIC_RELEASE);
+#endif
+  const char *reclaim = getenv("SOFTBOUND_RECLAIM");
+  __softbound_reclaim = reclaim == NULL || reclaim[0] != '0';
+  const char *thp = getenv("SOFTBOUND_THP");
+  __softbound_thp = thp != NULL && thp[0] == '1';
+  violation_policy_init();
 }
 
+// secondary table은 처음 포인터가 저장될 때 할당한다.
+// MAP_NORESERVE 이므로 실제로 쓰인 page만 메모리를 차지한다.
+// huge page로 바꿀 수 있도록 HUGE_PAGE_BYTES 경계에 맞춰 잡고 남는 앞뒤는 돌려준다.
 void *__softboundcets_trie_allocate(){
-  Metadata *secondary_entry;
-  size_t length = (__SOFTBOUNDCETS_TRIE_SECONDARY_TABLE_ENTRIES) * sizeof(Metadata);
-  secondary_entry = (Metadata *)mmap(0,length,PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  return secondary_entry;
+  size_t length = SECONDARY_TABLE_BYTES + HUGE_PAGE_BYTES;
+  char *raw = (char *)mmap(0, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED)
+    sb_fatal("secondary table mmap failed");
+  char *table = (char *)(((uintptr_t)raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1));
+  if (table != raw)
+    munmap(raw, table - raw);
+  if (raw + length != table + SECONDARY_TABLE_BYTES)
+    munmap(table + SECONDARY_TABLE_BYTES, raw + length - (table + SECONDARY_TABLE_BYTES));
+  return table;
 }
 
-void set_metadata(void *ptr, void *base, void *bound)
+// ptr이 속한 secondary table. 없으면 allocate가 true일 때만 새로 설치한다.
+static Metadata *metadata_secondary(void *ptr, bool allocate)
 {
   size_t primary_index = get_primary_index(ptr);
-  size_t secondary_index = get_secondary_index(ptr);
-  Metadata *secondary_table = primary_table[primary_index];
-  if(secondary_table == NULL){
-    secondary_table = __softboundcets_trie_allocate();
-    primary_table[primary_index] = secondary_table;
+  Metadata *secondary_table = __atomic_load_n(&primary_table[primary_index], __ATOMIC_ACQUIRE);
+  if (secondary_table == NULL && allocate)
+  {
+    Metadata *fresh = __softboundcets_trie_allocate();
+    if (__atomic_compare_exchange_n(&primary_table[primary_index], &secondary_table, fresh,
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      secondary_table = fresh;
+    }
+    else
+    {
+      // 다른 스레드가 먼저 설치했으므로 그 테이블(secondary_table에 담김)을 사용한다
+      munmap(fresh, SECONDARY_TABLE_BYTES);
+    }
   }
-  Metadata *entry = &secondary_table[secondary_index];
-  entry->base = base;
-  entry->bound = bound;
-  printf("Stored Malloc Info - base: %p, bound: %p\n",
-         primary_table[primary_index][secondary_index].base,
-         primary_table[primary_index][secondary_index].bound);
-  return;
+  return secondary_table;
+}
+
+static size_t min_size(size_t a, size_t b)
+{
+  return a < b ? a : b;
+}
+
+static secondary_occupancy *occupancy_of(size_t primary_index)
+{
+  return (secondary_occupancy *)(primary_table + PRIMARY_TABLE_ENTRIES) + primary_index;
+}
+
+static inline bool metadata_is_empty(Metadata *entry)
+{
+  return ((uintptr_t)__atomic_load_n(&entry->base, __ATOMIC_RELAXED) |
+          (uintptr_t)__atomic_load_n(&entry->bound, __ATOMIC_RELAXED)) == 0;
+}
+
+// 구간 안에서 metadata가 있는 slot 수
+static size_t metadata_count_run(Metadata *run, size_t n)
+{
+  size_t live = 0;
+  for (size_t i = 0; i < n; i++)
+    live += !metadata_is_empty(&run[i]);
+  return live;
 }
 
+static size_t reclaim_threshold(secondary_occupancy *occupancy)
+{
+  size_t reclaims = __atomic_load_n(&occupancy->reclaims, __ATOMIC_RELAXED);
+  return SECONDARY_HOT_SLOTS << min_size(reclaims, MAX_RECLAIM_BACKOFF);
+}
+
+// 빈 slot n개를 채우기 직전에 호출한다. 회수 중인 table이면 회수가 끝난 뒤에 쓰도록 기다린다.
+static void occupancy_add(Metadata *table, size_t primary_index, size_t n)
+{
+  secondary_occupancy *occupancy = occupancy_of(primary_index);
+  if (__softbound_reclaim &&
+      (__atomic_fetch_add(&occupancy->live, n, __ATOMIC_ACQ_REL) & SECONDARY_RECLAIMING))
+  {
+    while (__atomic_load_n(&occupancy->live, __ATOMIC_ACQUIRE) & SECONDARY_RECLAIMING)
+      __builtin_ia32_pause();
+  }
+  // fills는 회수 여부만 가르는 근사값이라 threshold에 닿으면 더 세지 않는다
+  size_t fills = __atomic_load_n(&occupancy->fills, __ATOMIC_RELAXED);
+  if (fills < reclaim_threshold(occupancy))
+  {
+    __atomic_store_n(&occupancy->fills, fills + n, __ATOMIC_RELAXED);
+    if (__softbound_thp && fills < SECONDARY_HOT_SLOTS && fills + n >= SECONDARY_HOT_SLOTS)
+      madvise(table, SECONDARY_TABLE_BYTES, MADV_HUGEPAGE);
+  }
+}
+
+// 채워져 있던 slot n개를 비운 뒤 호출한다. 마지막 slot이 비면 table의 page를 모두 돌려준다.
+static void occupancy_sub(Metadata *table, size_t primary_index, size_t n)
+{
+  if (!__softbound_reclaim)
+    return;
+  secondary_occupancy *occupancy = occupancy_of(primary_index);
+  if (__atomic_sub_fetch(&occupancy->live, n, __ATOMIC_ACQ_REL) != 0)
+    return;
+  if (__atomic_load_n(&occupancy->fills, __ATOMIC_RELAXED) < reclaim_threshold(occupancy))
+    return;
+  size_t expected = 0;
+  if (!__atomic_compare_exchange_n(&occupancy->live, &expected, SECONDARY_RECLAIMING, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return;
+  madvise(table, SECONDARY_TABLE_BYTES, MADV_DONTNEED);
+  __atomic_store_n(&occupancy->fills, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&occupancy->reclaims, occupancy->reclaims + 1, __ATOMIC_RELAXED);
+  __atomic_fetch_and(&occupancy->live, ~SECONDARY_RECLAIMING, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&__softbound_tables_reclaimed, 1, __ATOMIC_RELAXED);
+}
+
+// ptr slot에 base/bound를 저장하고 그 entry를 돌려준다
+static inline Metadata *metadata_set(void *ptr, void *base, void *bound)
+{
+  size_t primary_index = get_primary_index(ptr);
+  Metadata *secondary_table = metadata_secondary(ptr, true);
+  Metadata *entry = &secondary_table[get_secondary_index(ptr)];
+  bool was_empty = metadata_is_empty(entry);
+  bool is_empty = ((uintptr_t)base | (uintptr_t)bound) == 0;
+  if (was_empty && !is_empty)
+    occupancy_add(secondary_table, primary_index, 1);
+  metadata_store(entry, base, bound);
+  if (!was_empty && is_empty)
+    occupancy_sub(secondary_table, primary_index, 1);
+  SB_TRACE("Stored Malloc Info - base: %p, bound: %p\n", base, bound);
+  return entry;
+}
+
+#if SOFTBOUND_TEMPORAL
+static inline void temporal_store(Metadata *entry, size_t key, size_t lock)
+{
+  metadata_word_store((metadata_word *)entry + 1, metadata_pack((void *)key, (void *)lock));
+}
+
+SOFTBOUND_HOT
+void set_metadata_temporal(void *ptr, void *base, void *bound, size_t key, size_t lock)
+{
+  temporal_store(metadata_set(ptr, base, bound), key, lock);
+}
+#else
+SOFTBOUND_HOT
+void set_metadata(void *ptr, void *base, void *bound)
+{
+  metadata_set(ptr, base, bound);
+}
+#endif
+
+/*
+포인터를 초기값으로 가진 global의 metadata. pass가 모듈마다 상수 표 하나를 만들어
+__global_init에서 한 번 넘겨준다.
+*/
+typedef struct
+{
+  void *slot;
+  void *base;
+  void *bound;
+} global_pointer;
+
+void __softbound_register_globals(const global_pointer *table, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+#if SOFTBOUND_TEMPORAL
+    set_metadata_temporal(table[i].slot, table[i].base, table[i].bound, KEY_PERMANENT, LOCK_PERMANENT);
+#else
+    set_metadata(table[i].slot, table[i].base, table[i].bound);
+#endif
+  }
+}
+
+// 포인터 load마다 base/bound를 함께 읽는다. trie 탐색 한 번, 16바이트 load 한 번.
+// struct 반환이라 x86-64에서는 rax/rdx 두 register로 돌아온다.
+SOFTBOUND_HOT
+metadata_bounds get_metadata(void *access)
+{
+  Metadata *secondary_table = metadata_secondary(access, false);
+  if (secondary_table == NULL)
+    return (metadata_bounds){NULL, NULL};
+  return metadata_load(&secondary_table[get_secondary_index(access)]);
+}
+
+// 한 번도 저장되지 않은 영역은 secondary table이 없으므로 base/bound 모두 NULL로 본다
+SOFTBOUND_HOT
 void *get_base_addr(void *access){
-  size_t primary_index = get_primary_index(access);
-  size_t secondary_index = get_secondary_index(access);
-  void* base = primary_table[primary_index][secondary_index].base;
-  return base;
+  Metadata *secondary_table =
+      __atomic_load_n(&primary_table[get_primary_index(access)], __ATOMIC_ACQUIRE);
+  if (secondary_table == NULL)
+    return NULL;
+  return metadata_load(&secondary_table[get_secondary_index(access)]).base;
 }
+SOFTBOUND_HOT
 void *get_bound_addr(void *access){
-  size_t primary_index = get_primary_index(access);
-  size_t secondary_index = get_secondary_index(access);
-  void* bound = primary_table[primary_index][secondary_index].bound;
-  return bound;
+  Metadata *secondary_table =
+      __atomic_load_n(&primary_table[get_primary_index(access)], __ATOMIC_ACQUIRE);
+  if (secondary_table == NULL)
+    return NULL;
+  return metadata_load(&secondary_table[get_secondary_index(access)]).bound;
 }
 
-void print_metadata_table()
+/*
+여러 slot을 한 번에 처리하는 bulk 연산 (memcpy/memmove/memset, 구조체 복사, realloc/free)
+slot마다 trie를 다시 찾지 않고 secondary table 하나 안에서 연속된 slot 구간 단위로 처리한다.
+*/
+#define SLOT_ALIGN_DOWN(addr) ((uintptr_t)(addr) & ~(uintptr_t)(SOFTBOUND_SLOT_BYTES - 1))
+#define SLOT_ALIGN_UP(addr) SLOT_ALIGN_DOWN((uintptr_t)(addr) + SOFTBOUND_SLOT_BYTES - 1)
+
+// src가 NULL이면 dst 구간을 지운다. 겹치는 구간을 뒤로 옮길 때는 backward로 처리한다.
+// entry 안의 16바이트 word 단위로 옮긴다. 구간 복사는 slot마다 cmpxchg16b를 두 번(read, write) 돌면
+// 너무 느리므로 정렬된 SSE load/store를 그대로 쓴다. x86-64에서 정렬된 16바이트 SSE 접근은 한 번의
+// 접근이라 word 하나가 찢어지지 않는다(inline trie walk의 metadata load와 같은 근거).
+static void metadata_store_run(Metadata *dst, Metadata *src, size_t n, bool backward)
 {
-  printf("Printing non-empty entries in metadata table:\n");
-  for (size_t i = 0; i < PRIMARY_TABLE_SIZE; i++)
+  __m128i *dst_words = (__m128i *)dst;
+  __m128i *src_words = (__m128i *)src;
+  size_t words = n * METADATA_WORDS;
+  for (size_t k = 0; k < words; k++)
   {
-    if (primary_table[i])
+    size_t i = backward ? words - 1 - k : k;
+    _mm_store_si128(&dst_words[i], src_words ? _mm_load_si128(&src_words[i]) : _mm_setzero_si128());
+  }
+}
+
+// addr의 slot부터 같은 secondary table 끝까지 남은 slot 수
+static size_t slots_to_table_end(uintptr_t addr)
+{
+  return SECONDARY_TABLE_ENTRIES - get_secondary_index((void *)addr);
+}
+
+// addr의 slot을 포함해 같은 secondary table 처음까지의 slot 수
+static size_t slots_from_table_start(uintptr_t addr)
+{
+  return get_secondary_index((void *)addr) + 1;
+}
+
+// 구간을 비운다. 큰 구간에서 통째로 덮이는 metadata page는 0을 쓰는 대신 kernel에 돌려준다.
+static void metadata_discard_run(Metadata *run, size_t n)
+{
+  uintptr_t first = ((uintptr_t)run + METADATA_PAGE_BYTES - 1) & ~(uintptr_t)(METADATA_PAGE_BYTES - 1);
+  uintptr_t last = (uintptr_t)(run + n) & ~(uintptr_t)(METADATA_PAGE_BYTES - 1);
+  if (n * sizeof(Metadata) < DISCARD_MIN_BYTES || last <= first)
+  {
+    metadata_store_run(run, NULL, n, false);
+    return;
+  }
+  size_t head = (first - (uintptr_t)run) / sizeof(Metadata);
+  size_t tail = ((uintptr_t)(run + n) - last) / sizeof(Metadata);
+  metadata_store_run(run, NULL, head, false);
+  madvise((void *)first, last - first, MADV_DONTNEED);
+  metadata_store_run((Metadata *)last, NULL, tail, false);
+}
+
+// [ptr, ptr+size)와 겹치는 모든 slot의 metadata를 지운다
+void metadata_clear(void *ptr, size_t size)
+{
+  if (size == 0)
+    return;
+  uintptr_t addr = SLOT_ALIGN_DOWN(ptr);
+  uintptr_t end = SLOT_ALIGN_UP((uintptr_t)ptr + size);
+  while (addr < end)
+  {
+    size_t n = min_size((end - addr) / SOFTBOUND_SLOT_BYTES, slots_to_table_end(addr));
+    Metadata *table = metadata_secondary((void *)addr, false);
+    if (table != NULL)
     {
-      for (size_t j = 0; j < SECONDARY_TABLE_SIZE; j++)
+      Metadata *run = &table[get_secondary_index((void *)addr)];
+      if (!__softbound_reclaim)
       {
-        if (primary_table[i][j].base != NULL || primary_table[i][j].bound != NULL)
+        metadata_store_run(run, NULL, n, false);
+      }
+      else
+      {
+        // 포인터가 없던 영역은 metadata page를 더럽히지 않는다
+        size_t live = metadata_count_run(run, n);
+        if (live != 0)
         {
-          printf("Primary %zu, Secondary %zu -> Base: %p, Bound: %p\n",
-                 i, j, primary_table[i][j].base, primary_table[i][j].bound);
+          metadata_discard_run(run, n);
+          occupancy_sub(table, get_primary_index((void *)addr), live);
         }
       }
     }
+    addr += n * SOFTBOUND_SLOT_BYTES;
   }
 }
 
-void bound_check(void * base, void *bound, void *access)
+// src 영역에 저장된 포인터의 metadata를 dst 영역의 같은 offset으로 옮긴다 (겹쳐도 된다)
+void metadata_move(void *dst, void *src, size_t size)
 {
-  if(bound <= access){
-    printf("***out-of-bound detected***\n");
-    printf("accessing : %p, bound is : %p\n" ,access, bound);
-    print_memory_dump(access, base, bound);
+  uintptr_t d = (uintptr_t)dst;
+  uintptr_t s = (uintptr_t)src;
+  if (size == 0 || d == s)
+    return;
+  // slot 정렬이 달라지면 복사된 포인터가 slot에 맞지 않으므로 metadata가 없는 것으로 본다
+  if ((d - s) % SOFTBOUND_SLOT_BYTES != 0)
+  {
+    metadata_clear(dst, size);
+    return;
+  }
+  // 일부만 덮어쓴 양 끝 slot의 포인터는 깨졌으므로 지운다
+  if (d % SOFTBOUND_SLOT_BYTES != 0)
+    metadata_clear(dst, 1);
+  if ((d + size) % SOFTBOUND_SLOT_BYTES != 0)
+    metadata_clear((void *)(d + size - 1), 1);
+
+  uintptr_t d0 = SLOT_ALIGN_UP(d);
+  uintptr_t d1 = SLOT_ALIGN_DOWN(d + size);
+  if (d0 >= d1)
     return;
+  size_t n = (d1 - d0) / SOFTBOUND_SLOT_BYTES;
+  uintptr_t s0 = s + (d0 - d);
+  bool backward = d0 > s0 && d0 < s0 + n * SOFTBOUND_SLOT_BYTES;
+
+  while (n > 0)
+  {
+    size_t k;
+    uintptr_t dst_addr, src_addr;
+    if (backward)
+    {
+      uintptr_t dst_last = d0 + (n - 1) * SOFTBOUND_SLOT_BYTES;
+      uintptr_t src_last = s0 + (n - 1) * SOFTBOUND_SLOT_BYTES;
+      k = min_size(n, min_size(slots_from_table_start(dst_last), slots_from_table_start(src_last)));
+      dst_addr = dst_last - (k - 1) * SOFTBOUND_SLOT_BYTES;
+      src_addr = src_last - (k - 1) * SOFTBOUND_SLOT_BYTES;
+    }
+    else
+    {
+      k = min_size(n, min_size(slots_to_table_end(d0), slots_to_table_end(s0)));
+      dst_addr = d0;
+      src_addr = s0;
+      d0 += k * SOFTBOUND_SLOT_BYTES;
+      s0 += k * SOFTBOUND_SLOT_BYTES;
+    }
+
+    Metadata *src_table = metadata_secondary((void *)src_addr, false);
+    Metadata *dst_table = metadata_secondary((void *)dst_addr, src_table != NULL);
+    if (dst_table != NULL)
+    {
+      Metadata *dst_run = &dst_table[get_secondary_index((void *)dst_addr)];
+      Metadata *src_run = src_table ? &src_table[get_secondary_index((void *)src_addr)] : NULL;
+      if (!__softbound_reclaim)
+      {
+        metadata_store_run(dst_run, src_run, k, backward);
+      }
+      else
+      {
+        // 덮어쓰기 전에 양쪽을 세어 둔다. 겹치는 move라도 옮겨질 값은 원래 src 값이다.
+        size_t old_live = metadata_count_run(dst_run, k);
+        size_t new_live = src_run ? metadata_count_run(src_run, k) : 0;
+        size_t primary_index = get_primary_index((void *)dst_addr);
+        if (new_live > old_live)
+          occupancy_add(dst_table, primary_index, new_live - old_live);
+        if (old_live != 0 || new_live != 0)
+          metadata_store_run(dst_run, src_run, k, backward);
+        if (new_live < old_live)
+          occupancy_sub(dst_table, primary_index, old_live - new_live);
+      }
+    }
+    n -= k;
   }
 }
 
-void initialize_metadata_table()
+// memcpy 는 겹치지 않으므로 move와 같은 경로를 쓴다
+void metadata_copy(void *dst, void *src, size_t size)
 {
-  primary_table = mmap(NULL, sizeof(Metadata *) * PRIMARY_TABLE_SIZE,
-                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (primary_table == MAP_FAILED)
+  metadata_move(dst, src, size);
+}
+
+/*
+low-fat heap (pass의 -softbound-lowfat)
+- 크기 class c(16 << c 바이트)의 블록은 (c + 1) << LOWFAT_REGION_BITS에서 시작하는 32GB 영역에서만
+  class 크기로 정렬해 나눠 준다. 그러면 포인터 값만으로 base/bound를 다시 계산할 수 있다:
+  index = ptr >> LOWFAT_REGION_BITS, size = 1 << (index + LOWFAT_MIN_SHIFT - 1), base = ptr & -size.
+  pass는 load한 포인터가 이 영역에 있으면 trie 대신 이 계산을 inline 한다.
+- x86-64에는 상위 비트 tag를 무시하는 역참조가 없어 tag를 붙이면 접근마다 지워야 한다.
+  그래서 tag 대신 주소 자체의 상위 비트(영역 번호)가 class를 나타내게 한다.
+- class는 요청 크기 + 1바이트로 고른다. 배열 끝 바로 다음을 가리키는 포인터도 같은 블록의 base를 얻는다.
+- 값에서 얻은 bound는 class 크기라 padding 안쪽 overflow는 놓친다. 할당 직후의 포인터는 pass가 정확한 크기를 쓴다.
+- 영역은 첫 할당 때 MAP_NORESERVE로 예약한다. 하나라도 정해진 주소에 못 잡으면 모두 풀고 malloc만 쓴다.
+  __softbound_lowfat_classes가 0이면 어떤 포인터도 low-fat으로 보지 않는다(pass의 inline 판정도 이 값을 읽는다).
+- 해제된 블록은 class별 lock-free stack으로 재사용한다. 블록 첫 8바이트가 next, head는 {블록, tag} 16바이트이다.
+- LOWFAT_MAX_SIZE 이상이거나 영역이 가득 찬 class의 할당은 malloc으로 가고 지금처럼 trie를 쓴다.
+- 계측되지 않은 코드가 low-fat 블록을 free하면 안 된다(libc heap의 블록이 아니다).
+*/
+#define LOWFAT_REGION_BITS 35
+#define LOWFAT_REGION_BYTES ((size_t)1 << LOWFAT_REGION_BITS)
+#define LOWFAT_MIN_SHIFT 4
+#define LOWFAT_CLASSES 17
+#define LOWFAT_MAX_SIZE ((size_t)1 << (LOWFAT_MIN_SHIFT + LOWFAT_CLASSES - 1))
+#define LOWFAT_UNINITIALIZED 0
+#define LOWFAT_INITIALIZING 1
+#define LOWFAT_READY 2
+
+size_t __softbound_lowfat_classes = 0;
+int __softbound_lowfat_state = LOWFAT_UNINITIALIZED;
+size_t __softbound_lowfat_bump[LOWFAT_CLASSES];
+metadata_word __softbound_lowfat_free[LOWFAT_CLASSES];
+
+static inline size_t lowfat_index(const void *ptr)
+{
+  return (uintptr_t)ptr >> LOWFAT_REGION_BITS;
+}
+
+static inline bool lowfat_owns(const void *ptr)
+{
+  return lowfat_index(ptr) - 1 < __atomic_load_n(&__softbound_lowfat_classes, __ATOMIC_RELAXED);
+}
+
+static inline size_t lowfat_size(const void *ptr)
+{
+  return (size_t)1 << (lowfat_index(ptr) + LOWFAT_MIN_SHIFT - 1);
+}
+
+static inline void *lowfat_base(const void *ptr)
+{
+  return (void *)((uintptr_t)ptr & -(uintptr_t)lowfat_size(ptr));
+}
+
+static void *lowfat_region(size_t class)
+{
+  return (void *)((class + 1) << LOWFAT_REGION_BITS);
+}
+
+static void lowfat_init()
+{
+  int expected = LOWFAT_UNINITIALIZED;
+  if (!__atomic_compare_exchange_n(&__softbound_lowfat_state, &expected, LOWFAT_INITIALIZING,
+                                   false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+  {
+    while (__atomic_load_n(&__softbound_lowfat_state, __ATOMIC_ACQUIRE) != LOWFAT_READY)
+      __builtin_ia32_pause();
+    return;
+  }
+  size_t reserved = 0;
+  for (; reserved < LOWFAT_CLASSES; reserved++)
   {
-    perror("mmap failed");
-    exit(1);
+    // MAP_FIXED는 기존 mapping을 덮으므로 hint로만 요청하고 다른 주소가 오면 실패로 본다
+    void *region = lowfat_region(reserved);
+    void *got = mmap(region, LOWFAT_REGION_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (got == region)
+      continue;
+    if (got != MAP_FAILED)
+      munmap(got, LOWFAT_REGION_BYTES);
+    break;
   }
-  for (size_t i = 0; i < PRIMARY_TABLE_SIZE; i++)
+  if (reserved < LOWFAT_CLASSES)
   {
-    primary_table[i] = NULL; // 초기화 시 2차 테이블은 NULL로 설정
+    for (size_t class = 0; class < reserved; class++)
+      munmap(lowfat_region(class), LOWFAT_REGION_BYTES);
+    sb_report r = {.len = 0};
+    sb_report_str(&r, "softbound: low-fat regions are not available, falling back to malloc\n");
+    sb_report_flush(&r);
   }
-  printf("Primary table initialization done\n");
+  else
+    __atomic_store_n(&__softbound_lowfat_classes, LOWFAT_CLASSES, __ATOMIC_RELEASE);
+  __atomic_store_n(&__softbound_lowfat_state, LOWFAT_READY, __ATOMIC_RELEASE);
 }
-void print_metadata(void *base, void *bound){
-  printf("base address: %p\n", base);
-  printf("bound address: %p\n", bound);
+
+// size + 1바이트가 들어가는 가장 작은 class
+static size_t lowfat_class(size_t size)
+{
+  if (size < ((size_t)1 << LOWFAT_MIN_SHIFT))
+    return 0;
+  return 64 - __builtin_clzll(size) - LOWFAT_MIN_SHIFT;
 }
 
-/*
-size_t hash(void *ptr)
+static metadata_word lowfat_list_entry(void *block, metadata_word prev)
 {
-  return ((uintptr_t)ptr >> 4) % HASH_TABLE_SIZE;
+  return (metadata_word)(uintptr_t)block | ((prev >> 64) + 1) << 64;
+}
+
+static void *lowfat_pop(size_t class)
+{
+  metadata_word *list = &__softbound_lowfat_free[class];
+  metadata_word head = __sync_val_compare_and_swap(list, 0, 0);
+  while ((uintptr_t)head != 0)
+  {
+    void **block = (void **)(uintptr_t)head;
+    // 영역은 unmap하지 않으므로 다른 스레드가 먼저 꺼낸 블록을 읽어도 안전하고, 그때는 tag가 달라 CAS가 실패한다
+    void *next = __atomic_load_n(block, __ATOMIC_RELAXED);
+    metadata_word seen = __sync_val_compare_and_swap(list, head, lowfat_list_entry(next, head));
+    if (seen == head)
+      return block;
+    head = seen;
+  }
+  return NULL;
 }
 
-// 메타데이터 설정 함수
-void set_metadata(void *ptr, size_t size)
+static void lowfat_push(void *block)
 {
-  size_t index = hash(ptr);
-  metadata_table[index].base = ptr;
-  metadata_table[index].bound = (char *)ptr + size;
-  printf("Stored Malloc Info - base: %p, bound: %p\n", metadata_table[index].base, metadata_table[index].bound);
+  metadata_word *list = &__softbound_lowfat_free[lowfat_index(block) - 1];
+  metadata_word head = __sync_val_compare_and_swap(list, 0, 0);
+  for (;;)
+  {
+    __atomic_store_n((void **)block, (void *)(uintptr_t)head, __ATOMIC_RELAXED);
+    metadata_word seen = __sync_val_compare_and_swap(list, head, lowfat_list_entry(block, head));
+    if (seen == head)
+      return;
+    head = seen;
+  }
 }
 
-bool get_metadata(void *ptr)
+// low-fat 영역에서 블록을 받는다. 영역이 없거나 class가 가득 찼으면 NULL
+static void *lowfat_alloc(size_t size)
 {
-  size_t index = hash(ptr);
-  Metadata metadata = metadata_table[index];
+  if (size >= LOWFAT_MAX_SIZE)
+    return NULL;
+  if (__atomic_load_n(&__softbound_lowfat_state, __ATOMIC_ACQUIRE) != LOWFAT_READY)
+    lowfat_init();
+  if (__softbound_lowfat_classes == 0)
+    return NULL;
+  size_t class = lowfat_class(size);
+  void *block = lowfat_pop(class);
+  if (block != NULL)
+    return block;
+  size_t bytes = (size_t)1 << (class + LOWFAT_MIN_SHIFT);
+  size_t offset = __atomic_fetch_add(&__softbound_lowfat_bump[class], bytes, __ATOMIC_RELAXED);
+  if (offset + bytes > LOWFAT_REGION_BYTES)
+    return NULL;
+  return (char *)lowfat_region(class) + offset;
+}
 
-  return (metadata.base != NULL && metadata.bound != NULL);
+void *softbound_lowfat_malloc(size_t size)
+{
+  void *block = lowfat_alloc(size);
+  return block != NULL ? block : malloc(size);
+}
+
+// 재사용된 블록에는 이전 내용이 남아 있으므로 새로 받은 영역이라도 항상 0으로 채운다
+void *softbound_lowfat_calloc(size_t count, size_t size)
+{
+  size_t bytes;
+  if (__builtin_mul_overflow(count, size, &bytes))
+    return calloc(count, size);
+  void *block = lowfat_alloc(bytes);
+  if (block == NULL)
+    return calloc(count, size);
+  memset(block, 0, bytes);
+  return block;
+}
+
+// load한 포인터 ptr이 low-fat 블록이면 값에서 base/bound를 계산하고, 아니면 저장 위치 access의 trie를 읽는다
+SOFTBOUND_HOT
+metadata_bounds get_metadata_lowfat(void *access, void *ptr)
+{
+  if (!lowfat_owns(ptr))
+    return get_metadata(access);
+  char *base = lowfat_base(ptr);
+  return (metadata_bounds){base, base + lowfat_size(ptr)};
+}
+
+// 블록 안에 남은 포인터 metadata를 지우고 class의 free list에 돌려준다
+static void lowfat_free(void *ptr)
+{
+  metadata_clear(ptr, lowfat_size(ptr));
+  lowfat_push(ptr);
+}
+
+// low-fat 블록은 같은 class 안에서는 제자리에서 늘고 줄며, class가 바뀌면 새 블록으로 옮긴다
+static void *lowfat_realloc(void *ptr, size_t size)
+{
+  size_t old_size = lowfat_size(ptr);
+  if (size == 0)
+  {
+    lowfat_free(ptr);
+    return NULL;
+  }
+  if (size < LOWFAT_MAX_SIZE && lowfat_class(size) == lowfat_index(ptr) - 1)
+    return ptr;
+  void *result = softbound_lowfat_malloc(size);
+  if (result == NULL)
+    return NULL;
+  size_t copy = min_size(old_size, size);
+  memcpy(result, ptr, copy);
+  metadata_copy(result, ptr, copy);
+  lowfat_free(ptr);
+  return result;
+}
+
+// realloc으로 옮겨진 블록의 metadata를 새 주소로 복사하고 이전 주소의 것은 지운다.
+// 이전 블록은 이미 해제됐으므로 포인터가 아닌 정수 주소로 받고, inline 되어 gcc가 정수를 다시
+// 해제된 포인터로 보지 않도록(-Wuse-after-free) 따로 둔다.
+__attribute__((noinline))
+static void metadata_relocate(uintptr_t new_addr, uintptr_t old_addr, size_t copy_size, size_t old_size)
+{
+  metadata_copy((void *)new_addr, (void *)old_addr, copy_size);
+  metadata_clear((void *)old_addr, old_size);
+}
+
+// 블록이 이동하면 블록 안에 저장돼 있던 포인터의 metadata도 새 위치로 옮긴다
+void *softbound_realloc(void *ptr, size_t size)
+{
+  if (lowfat_owns(ptr))
+    return lowfat_realloc(ptr, size);
+  size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+  // 이전 블록은 주소로만(metadata index 계산) 사용한다
+  uintptr_t old_addr = (uintptr_t)ptr;
+  void *result = realloc(ptr, size);
+  if (result != NULL && old_addr != 0 && (uintptr_t)result != old_addr)
+    metadata_relocate((uintptr_t)result, old_addr, min_size(old_size, size), old_size);
+  return result;
+}
+
+// 해제된 블록 안에 남아 있던 포인터 metadata가 재사용된 메모리에서 보이지 않도록 지운다
+void softbound_free(void *ptr)
+{
+  if (lowfat_owns(ptr))
+  {
+    lowfat_free(ptr);
+    return;
+  }
+  if (ptr != NULL)
+    metadata_clear(ptr, malloc_usable_size(ptr));
+  free(ptr);
+}
+
+// munmap 전에 metadata를 지운다. 해제한 뒤에 지우면 그 사이 같은 주소에 새로 mapping된 영역의 metadata까지 지울 수 있다.
+int softbound_munmap(void *addr, size_t length)
+{
+  metadata_clear(addr, length);
+  return munmap(addr, length);
 }
 
 void print_metadata_table()
 {
   printf("Printing non-empty entries in metadata table:\n");
-  for (size_t i = 0; i < HASH_TABLE_SIZE; i++)
+  for (size_t i = 0; i < PRIMARY_TABLE_ENTRIES; i++)
   {
-    if (metadata_table[i].base != NULL || metadata_table[i].bound != NULL)
+    if (primary_table[i])
     {
-      printf("Index %zu -> Base: %p, Bound: %p\n", i, metadata_table[i].base, metadata_table[i].bound);
+      for (size_t j = 0; j < SECONDARY_TABLE_ENTRIES; j++)
+      {
+        if (primary_table[i][j].base != NULL || primary_table[i][j].bound != NULL)
+        {
+          printf("Primary %zu, Secondary %zu -> Base: %p, Bound: %p\n",
+                 i, j, primary_table[i][j].base, primary_table[i][j].bound);
+        }
+      }
     }
   }
 }
 
-void bound_check(void *ptr, void *access, const char *inst)
+/*
+함수 호출 경계에서 포인터 metadata를 전달하는 스레드별 shadow stack
+frame 구성: [0] header {이전 frame 시작 위치, callee 주소}, [1] 반환값, [2..] 포인터 인자
+호출자가 shadow_stack_allocate로 frame을 만들고 인자 metadata를 저장하면
+피호출자는 prologue에서 읽고, 포인터를 반환할 때 반환 slot에 저장한다.
+header의 callee가 자기 자신이 아니면(계측되지 않은 코드에서 호출된 경우)
+피호출자는 NULL base / 무한 bound를 사용한다.
+*/
+#define SHADOW_STACK_ENTRIES ((size_t)1 << 20)
+#define SHADOW_STACK_HEADER 1
+
+__thread Metadata *__softbound_shadow_stack = NULL;
+__thread size_t __softbound_shadow_stack_top = 0;        // 현재 frame 시작 위치
+__thread size_t __softbound_shadow_stack_frame_size = 0; // 현재 frame 크기 (header 포함)
+
+static Metadata *shadow_stack_frame(void *callee)
+{
+  if (__softbound_shadow_stack == NULL || __softbound_shadow_stack_frame_size == 0)
+    return NULL;
+  Metadata *frame = &__softbound_shadow_stack[__softbound_shadow_stack_top];
+  if (frame->bound != callee)
+    return NULL;
+  return frame;
+}
+
+// 스레드의 첫 호출에서만 실행되므로 inline 되는 shadow_stack_allocate 밖에 둔다
+__attribute__((noinline, cold))
+static void shadow_stack_init()
+{
+  __softbound_shadow_stack = mmap(NULL, SHADOW_STACK_ENTRIES * sizeof(Metadata), PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (__softbound_shadow_stack == MAP_FAILED)
+    sb_fatal("shadow stack mmap failed");
+}
+
+SOFTBOUND_HOT
+void shadow_stack_allocate(size_t nargs, void *callee)
+{
+  if (__softbound_shadow_stack == NULL)
+    shadow_stack_init();
+  size_t prev_top = __softbound_shadow_stack_top;
+  size_t new_top = __softbound_shadow_stack_top + __softbound_shadow_stack_frame_size;
+  size_t new_size = SHADOW_STACK_HEADER + 1 + nargs;
+  if (new_top + new_size > SHADOW_STACK_ENTRIES)
+    sb_fatal("shadow stack overflow");
+  Metadata *frame = &__softbound_shadow_stack[new_top];
+  frame[0].base = (void *)prev_top;
+  frame[0].bound = callee;
+  // 계측되지 않은 피호출자가 반환한 포인터는 무한 bound로 본다
+  frame[SHADOW_STACK_HEADER].base = NULL;
+  frame[SHADOW_STACK_HEADER].bound = (void *)UINTPTR_MAX;
+#if SOFTBOUND_TEMPORAL
+  frame[SHADOW_STACK_HEADER].key = KEY_PERMANENT;
+  frame[SHADOW_STACK_HEADER].lock = LOCK_PERMANENT;
+#endif
+  __softbound_shadow_stack_top = new_top;
+  __softbound_shadow_stack_frame_size = new_size;
+}
+
+SOFTBOUND_HOT
+void shadow_stack_deallocate()
+{
+  size_t prev_top = (size_t)__softbound_shadow_stack[__softbound_shadow_stack_top].base;
+  __softbound_shadow_stack_frame_size = __softbound_shadow_stack_top - prev_top;
+  __softbound_shadow_stack_top = prev_top;
+}
+
+// index 0은 반환값, 1부터는 포인터 인자 순서
+SOFTBOUND_HOT
+void shadow_stack_store(size_t index, void *base, void *bound)
+{
+  Metadata *slot = &__softbound_shadow_stack[__softbound_shadow_stack_top + SHADOW_STACK_HEADER + index];
+  slot->base = base;
+  slot->bound = bound;
+}
+
+SOFTBOUND_HOT
+void shadow_stack_store_return(void *callee, void *base, void *bound)
+{
+  Metadata *frame = shadow_stack_frame(callee);
+  if (frame == NULL)
+    return;
+  frame[SHADOW_STACK_HEADER].base = base;
+  frame[SHADOW_STACK_HEADER].bound = bound;
+}
+
+SOFTBOUND_HOT
+void *shadow_stack_load_base(size_t index, void *callee)
+{
+  Metadata *frame = shadow_stack_frame(callee);
+  return frame ? frame[SHADOW_STACK_HEADER + index].base : NULL;
+}
+
+SOFTBOUND_HOT
+void *shadow_stack_load_bound(size_t index, void *callee)
+{
+  Metadata *frame = shadow_stack_frame(callee);
+  return frame ? frame[SHADOW_STACK_HEADER + index].bound : (void *)UINTPTR_MAX;
+}
+
+#if SOFTBOUND_TEMPORAL
+// 포인터 인자/반환값의 key/lock. 계측 밖에서 호출되면 LOCK_PERMANENT로 본다
+SOFTBOUND_HOT
+void shadow_stack_store_id(size_t index, size_t key, size_t lock)
+{
+  Metadata *slot = &__softbound_shadow_stack[__softbound_shadow_stack_top + SHADOW_STACK_HEADER + index];
+  slot->key = key;
+  slot->lock = lock;
+}
+
+SOFTBOUND_HOT
+void shadow_stack_store_return_id(void *callee, size_t key, size_t lock)
+{
+  Metadata *frame = shadow_stack_frame(callee);
+  if (frame == NULL)
+    return;
+  frame[SHADOW_STACK_HEADER].key = key;
+  frame[SHADOW_STACK_HEADER].lock = lock;
+}
+
+SOFTBOUND_HOT
+size_t shadow_stack_load_key(size_t index, void *callee)
+{
+  Metadata *frame = shadow_stack_frame(callee);
+  return frame ? frame[SHADOW_STACK_HEADER + index].key : KEY_PERMANENT;
+}
+
+SOFTBOUND_HOT
+size_t shadow_stack_load_lock(size_t index, void *callee)
 {
-  size_t index = hash(ptr);
-  Metadata metadata = metadata_table[index];
+  Metadata *frame = shadow_stack_frame(callee);
+  return frame ? frame[SHADOW_STACK_HEADER + index].lock : LOCK_PERMANENT;
+}
+#endif
+
+/*
+위반 처리. site는 위반한 검사의 return address로, 같은 위치의 반복 위반을 하나로 묶는 key다.
+in-bounds 경로에 영향이 없도록 모두 noinline/cold 함수 안에서 처리한다.
+*/
+__attribute__((noinline, cold))
+static void violation_at(void *site, const char *kind, void *base, void *bound, void *access,
+                         size_t size)
+{
+  violation_site *entry = violation_site_lookup((uintptr_t)site);
+  size_t hits;
+  if (entry != NULL)
+    hits = __atomic_add_fetch(&entry->hits, 1, __ATOMIC_RELAXED);
+  else
+    hits = __atomic_add_fetch(&__softbound_violations_unsited, 1, __ATOMIC_RELAXED);
 
-  // 경계 정보가 제대로 설정되어 있는지 확인
-  if (metadata.base == NULL || metadata.bound == NULL)
+  int policy = __softbound_policy;
+  if (policy == SB_POLICY_COUNT || (policy == SB_POLICY_LOG && hits > 1))
+    return;
+  if (policy == SB_POLICY_LOG && !violation_report_allowed())
   {
-    printf("Error: Metadata not found for pointer %p\n", ptr);
+    __atomic_add_fetch(&__softbound_reports_suppressed, 1, __ATOMIC_RELAXED);
     return;
   }
 
-  printf("Memory access at %p for pointer %p[%s]\n", access, ptr, inst);
-  printf("Bound info - Base: %p, Bound: %p\n", metadata.base, metadata.bound);
+  sb_report r = {.len = 0};
+  sb_report_str(&r, "***");
+  sb_report_str(&r, kind);
+  sb_report_str(&r, " detected*** accessing ");
+  sb_report_num(&r, (uintptr_t)access, 16);
+  sb_report_str(&r, " (size ");
+  sb_report_num(&r, size, 10);
+  sb_report_str(&r, "), base ");
+  sb_report_num(&r, (uintptr_t)base, 16);
+  sb_report_str(&r, ", bound ");
+  sb_report_num(&r, (uintptr_t)bound, 16);
+  sb_report_str(&r, ", site ");
+  sb_report_num(&r, (uintptr_t)site, 16);
+  sb_report_str(&r, "\n");
+  sb_report_flush(&r);
+  if (__softbound_dump)
+    print_memory_dump(access, base, bound);
+
+  if (policy == SB_POLICY_ABORT)
+    abort();
+  if (policy == SB_POLICY_TRAP)
+    __builtin_trap();
+}
+
+// inline check 모드에서 위반이 확인된 경우에만 호출되는 cold path
+__attribute__((noinline, cold))
+void report_violation(void *base, void *bound, void *access, size_t size)
+{
+  violation_at(__builtin_return_address(0), "out-of-bound", base, bound, access, size);
+}
 
-  // 접근 주소가 base 이상이고, bound보다 작은지 확인
-  if (access >= metadata.base && access < metadata.bound)
+// [access, access+size)가 [base, bound) 밖인가. access + size는 큰 size(memcpy의 n-1 등)에서 wrap 하므로
+// access가 범위 안인 것을 확인한 뒤 남은 길이 bound - access와 비교한다.
+static inline bool out_of_bounds(void *base, void *bound, void *access, size_t size)
+{
+  uintptr_t start = (uintptr_t)access;
+  return start < (uintptr_t)base || start > (uintptr_t)bound ||
+         size > (uintptr_t)bound - start;
+}
+
+// [access, access+size) 전체가 [base, bound) 안에 있는지 하한/상한 모두 검사
+// bitcode로 inline 된 경우 site는 검사를 포함한 함수의 return address가 된다
+SOFTBOUND_HOT
+void bound_check(void *base, void *bound, void *access, size_t size)
+{
+  if (out_of_bounds(base, bound, access, size))
   {
-    printf("Access within bounds.\n");
+    violation_at(__builtin_return_address(0), "out-of-bound", base, bound, access, size);
   }
-  else
+}
+
+#if SOFTBOUND_TEMPORAL
+static inline bool temporal_valid(size_t key, size_t lock)
+{
+  return __atomic_load_n(&__softbound_locks[lock], __ATOMIC_RELAXED) == key;
+}
+
+// inline check의 공간/시간 조건 중 하나가 실패했을 때만 호출된다. 어느 쪽인지 다시 가려 보고한다.
+__attribute__((noinline, cold))
+void report_violation_temporal(void *base, void *bound, void *access, size_t size, size_t key,
+                               size_t lock)
+{
+  bool spatial = out_of_bounds(base, bound, access, size);
+  violation_at(__builtin_return_address(0), spatial ? "out-of-bound" : "use-after-free",
+               base, bound, access, size);
+}
+
+SOFTBOUND_HOT
+void bound_check_temporal(void *base, void *bound, void *access, size_t size, size_t key,
+                          size_t lock)
+{
+  bool spatial = out_of_bounds(base, bound, access, size);
+  if (spatial || !temporal_valid(key, lock))
+    violation_at(__builtin_return_address(0), spatial ? "out-of-bound" : "use-after-free",
+                 base, bound, access, size);
+}
+
+// 로드된 포인터의 key/lock. 저장된 적 없는 slot은 {0, LOCK_NONE}
+SOFTBOUND_HOT
+temporal_id get_temporal_id(void *access)
+{
+  Metadata *secondary_table = metadata_secondary(access, false);
+  if (secondary_table == NULL)
+    return (temporal_id){0, LOCK_NONE};
+  Metadata *entry = &secondary_table[get_secondary_index(access)];
+  metadata_word word = metadata_word_load((metadata_word *)entry + 1);
+  return (temporal_id){(size_t)word, (size_t)(word >> 64)};
+}
+
+static metadata_word lock_list_load()
+{
+  return __sync_val_compare_and_swap(&__softbound_lock_free_list, 0, 0);
+}
+
+static metadata_word lock_list_entry(size_t lock, metadata_word prev)
+{
+  return (metadata_word)lock | ((prev >> 64) + 1) << 64;
+}
+
+static size_t lock_pop()
+{
+  metadata_word head = lock_list_load();
+  while ((size_t)head != LOCK_NONE)
   {
-    printf("*** Out-of-bound access detected ***\n");
+    size_t lock = (size_t)head;
+    // 다른 스레드가 먼저 꺼내 key를 썼다면 next는 엉뚱한 값이지만 tag가 바뀌어 CAS가 실패한다
+    size_t next = __atomic_load_n(&__softbound_locks[lock], __ATOMIC_ACQUIRE) & ~LOCK_FREE;
+    metadata_word seen =
+        __sync_val_compare_and_swap(&__softbound_lock_free_list, head, lock_list_entry(next, head));
+    if (seen == head)
+      return lock;
+    head = seen;
   }
+  size_t lock = __atomic_fetch_add(&__softbound_lock_bump, 1, __ATOMIC_RELAXED);
+  if (lock < LOCK_POOL_ENTRIES)
+    return lock;
+  __atomic_fetch_add(&__softbound_locks_exhausted, 1, __ATOMIC_RELAXED);
+  return LOCK_PERMANENT;
 }
 
-void initialize_metadata_table()
+static void lock_push(size_t lock)
 {
-  size_t mmap_size = sizeof(Metadata) * HASH_TABLE_SIZE;
+  metadata_word head = lock_list_load();
+  for (;;)
+  {
+    __atomic_store_n(&__softbound_locks[lock], LOCK_FREE | (size_t)head, __ATOMIC_RELEASE);
+    metadata_word seen =
+        __sync_val_compare_and_swap(&__softbound_lock_free_list, head, lock_list_entry(lock, head));
+    if (seen == head)
+      return;
+    head = seen;
+  }
+}
+
+// heap 할당 직후 호출된다. 할당이 실패했으면 key/lock도 주지 않는다
+temporal_id __softbound_lock_acquire(void *ptr)
+{
+  if (ptr == NULL)
+    return (temporal_id){0, LOCK_NONE};
+  size_t lock = lock_pop();
+  if (lock == LOCK_PERMANENT)
+    return (temporal_id){KEY_PERMANENT, LOCK_PERMANENT};
+  size_t key = __atomic_fetch_add(&__softbound_next_key, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&__softbound_locks[lock], key, __ATOMIC_RELEASE);
+  return (temporal_id){key, lock};
+}
 
-  metadata_table = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (metadata_table == MAP_FAILED)
+// key가 맞을 때만 lock을 무효화하고 pool에 돌려준다. 두 스레드가 같은 블록을 해제해도 한쪽만 성공한다.
+// heap key가 없는 포인터(계측 밖에서 할당된 블록)는 검사할 수 없으므로 통과시킨다.
+static bool lock_release(size_t key, size_t lock)
+{
+  if (lock == LOCK_NONE || lock == LOCK_PERMANENT)
+    return true;
+  size_t expected = key;
+  if (!__atomic_compare_exchange_n(&__softbound_locks[lock], &expected, LOCK_FREE, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return false;
+  lock_push(lock);
+  return true;
+}
+
+// 이미 해제된 블록을 다시 해제하면 보고만 하고 free는 호출하지 않는다(heap 손상 방지)
+void softbound_free_temporal(void *ptr, size_t key, size_t lock)
+{
+  if (ptr == NULL)
+    return;
+  if (!lock_release(key, lock))
   {
-    perror("mmap failed");
-    exit(1);
+    violation_at(__builtin_return_address(0), "double free", ptr, ptr, ptr, 0);
+    return;
   }
-  else
+  softbound_free(ptr);
+}
+
+// 옮겨지든 아니든 realloc 뒤에는 이전 포인터를 무효로 본다. 호출 뒤 pass가 결과에 새 key/lock을 받는다.
+void *softbound_realloc_temporal(void *ptr, size_t size, size_t key, size_t lock)
+{
+  if (ptr != NULL && !temporal_valid(key, lock))
   {
-    printf("mmap done\n");
+    violation_at(__builtin_return_address(0), "use-after-free", ptr, ptr, ptr, 0);
+    return NULL;
   }
+  void *result = softbound_realloc(ptr, size);
+  if (ptr != NULL && (result != NULL || size == 0))
+    lock_release(key, lock);
+  return result;
+}
+#endif
+
+/*
+검사 위치별 실행 횟수 profile (pass의 -softbound-site-counters)
+계측된 모듈은 __global_init에서 자기 site_table을 등록하고, 종료 시 모든 표를
+SOFTBOUND_PROFILE(기본 softbound.profile)에 "횟수 key" 줄로 기록한다.
+key 형식은 pass의 getSiteKey 참고.
+*/
+typedef struct site_table
+{
+  size_t *counters;
+  const char **keys;
+  size_t count;
+  struct site_table *next;
+} site_table;
+
+site_table *__softbound_site_tables = NULL;
 
-  for (size_t i = 0; i < HASH_TABLE_SIZE; i++)
+static void write_site_profile()
+{
+  const char *path = getenv("SOFTBOUND_PROFILE");
+  if (path == NULL)
+    path = "softbound.profile";
+  FILE *out = fopen(path, "w");
+  if (out == NULL)
   {
-    metadata_table[i].base = NULL;
-    metadata_table[i].bound = NULL;
+    perror("softbound: cannot write profile");
+    return;
   }
+  fprintf(out, "# softbound check profile: <count> <function:file:line:col#n>\n");
+  for (site_table *table = __softbound_site_tables; table != NULL; table = table->next)
+  {
+    for (size_t i = 0; i < table->count; i++)
+      fprintf(out, "%zu %s\n", table->counters[i], table->keys[i]);
+  }
+  fclose(out);
+}
+
+void __softbound_register_sites(site_table *table)
+{
+  site_table *head = __atomic_load_n(&__softbound_site_tables, __ATOMIC_ACQUIRE);
+  do
+  {
+    table->next = head;
+  } while (!__atomic_compare_exchange_n(&__softbound_site_tables, &head, table, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  // 첫 등록 때만 종료 handler를 건다
+  if (head == NULL)
+    atexit(write_site_profile);
+}
+
+void print_metadata(void *base, void *bound){
+  SB_TRACE("base address: %p\n", base);
+  SB_TRACE("bound address: %p\n", bound);
 }
-*/
\ No newline at end of file
@@ -0,0 +1,133 @@
+// test_threads.c
+// runtime metadata table 동시성 stress test (SOFTBOUND_TEMPORAL=0 runtime)
+// 1. 여러 thread가 아직 secondary table이 없는 영역에 동시에 저장해도 metadata를 잃지 않는다
+// 2. 같은 slot을 쓰는 동안 읽은 base/bound가 한 번에 쓴 쌍 중 하나이다 (찢어진 값이 없다)
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+  void *base;
+  void *bound;
+} metadata_bounds;
+
+void _init_metadata_table(void);
+void set_metadata(void *ptr, void *base, void *bound);
+metadata_bounds get_metadata(void *access);
+void metadata_copy(void *dst, void *src, size_t size);
+
+#define THREADS 8
+#define REGIONS 8
+#define REGION_BYTES ((size_t)32 << 20) // secondary table 하나가 덮는 범위 (slot 8바이트)
+#define ITERATIONS 200000
+
+static char *arena;
+static pthread_barrier_t start;
+static long failures;
+
+// 쌍마다 bound - base가 다르므로 base와 bound가 다른 쓰기에서 오면 알아챈다
+static char pair_a[16], pair_b[32];
+static void *shared_slot;
+static void *copy_src[2];
+
+static void fail(const char *what, metadata_bounds md)
+{
+  __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+  fprintf(stderr, "%s: base=%p bound=%p\n", what, md.base, md.bound);
+}
+
+static int valid_pair(metadata_bounds md)
+{
+  return (md.base == NULL && md.bound == NULL) ||
+         (md.base == pair_a && md.bound == pair_a + sizeof(pair_a)) ||
+         (md.base == pair_b && md.bound == pair_b + sizeof(pair_b));
+}
+
+// 모든 thread가 같은 순간에 새 영역마다 자기 slot을 쓴다
+static void *install_worker(void *arg)
+{
+  uintptr_t id = (uintptr_t)arg;
+  pthread_barrier_wait(&start);
+  for (int r = 0; r < REGIONS; r++)
+  {
+    char *slot = arena + r * REGION_BYTES + id * sizeof(void *);
+    set_metadata(slot, slot, slot + id + 1);
+  }
+  return NULL;
+}
+
+// 짝수 thread는 두 쌍을 번갈아 쓰거나 복사하고, 홀수 thread는 읽어서 확인한다
+static void *race_worker(void *arg)
+{
+  uintptr_t id = (uintptr_t)arg;
+  pthread_barrier_wait(&start);
+  for (long i = 0; i < ITERATIONS; i++)
+  {
+    if (id % 2 == 0)
+    {
+      if (i % 3 == 2)
+        metadata_copy(&shared_slot, &copy_src[i % 2], sizeof(void *));
+      else if (i % 2)
+        set_metadata(&shared_slot, pair_a, pair_a + sizeof(pair_a));
+      else
+        set_metadata(&shared_slot, pair_b, pair_b + sizeof(pair_b));
+    }
+    else
+    {
+      metadata_bounds md = get_metadata(&shared_slot);
+      if (!valid_pair(md))
+        fail("torn metadata", md);
+    }
+  }
+  return NULL;
+}
+
+static void run(void *(*worker)(void *))
+{
+  pthread_t threads[THREADS];
+  pthread_barrier_init(&start, NULL, THREADS);
+  for (uintptr_t t = 0; t < THREADS; t++)
+    pthread_create(&threads[t], NULL, worker, (void *)t);
+  for (int t = 0; t < THREADS; t++)
+    pthread_join(threads[t], NULL);
+  pthread_barrier_destroy(&start);
+}
+
+int main()
+{
+  _init_metadata_table();
+
+  // 영역 경계에 맞춘 주소 범위. 실제로 접근하지 않으므로 예약만 한다
+  arena = mmap(NULL, (REGIONS + 1) * REGION_BYTES, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+  arena = (char *)(((uintptr_t)arena + REGION_BYTES - 1) & ~(REGION_BYTES - 1));
+
+  printf("1. concurrent secondary table install\n");
+  run(install_worker);
+  for (int r = 0; r < REGIONS; r++)
+  {
+    for (uintptr_t id = 0; id < THREADS; id++)
+    {
+      char *slot = arena + r * REGION_BYTES + id * sizeof(void *);
+      metadata_bounds md = get_metadata(slot);
+      if (md.base != slot || md.bound != slot + id + 1)
+        fail("lost metadata", md);
+    }
+  }
+
+  printf("2. concurrent update/copy/read of one slot\n");
+  set_metadata(&copy_src[0], pair_a, pair_a + sizeof(pair_a));
+  set_metadata(&copy_src[1], pair_b, pair_b + sizeof(pair_b));
+  run(race_worker);
+
+  printf("%s: %ld failures\n", failures ? "FAIL" : "ok", failures);
+  return failures != 0;
+}
@@ -0,0 +1,3 @@
+# runtime metadata table 동시성 stress test. pass 없이 runtime과 바로 링크한다
+gcc -O2 -mcx16 -pthread test_threads.c softbound.c -o test_threads
+./test_threads